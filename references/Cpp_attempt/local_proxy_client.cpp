@@ -6,13 +6,13 @@
 // Global pointer for signal handling
 std::unique_ptr<zeroconf::ProxyServer> g_server;
 
-// Signal handler for graceful shutdown (Ctrl+C)
-void signal_handler(int signal) {
-    std::cout << "\n[Main] Received shutdown signal..." << std::endl;
+// Signal handler for graceful shutdown (Ctrl+C). Only sets an atomic
+// flag (the one thing that's safe in a signal handler); main() notices
+// and runs the real drain-based stop().
+void signal_handler(int /*signal*/) {
     if (g_server) {
-        g_server->stop();
+        g_server->request_stop();
     }
-    exit(0);
 }
 
 int main(int argc, char* argv[]) {
@@ -42,6 +42,15 @@ int main(int argc, char* argv[]) {
         else if (arg == "--host" && i + 1 < argc) {
             config.host = argv[++i];
         }
+        else if (arg == "--socket" && i + 1 < argc) {
+            config.unix_socket_path = argv[++i];
+        }
+        else if (arg == "--shared-table") {
+            config.use_shared_service_table = true;
+        }
+        else if (arg == "--completion-cache") {
+            config.enable_completion_cache = true;
+        }
         else if (arg == "--quiet") {
             config.verbose = false;
         }
@@ -50,6 +59,12 @@ int main(int argc, char* argv[]) {
             std::cout << "Options:" << std::endl;
             std::cout << "  --port <port>    Proxy listen port (default: 8080)" << std::endl;
             std::cout << "  --host <host>    Proxy listen host (default: 127.0.0.1)" << std::endl;
+            std::cout << "  --socket <path>  Also listen on a Unix domain socket" << std::endl;
+            std::cout << "                   (faster for clients on this machine)" << std::endl;
+            std::cout << "  --shared-table   Share one discovery/health prober between" << std::endl;
+            std::cout << "                   all proxy instances on this host" << std::endl;
+            std::cout << "  --completion-cache  Serve repeated deterministic" << std::endl;
+            std::cout << "                   (temperature 0) completions from a cache" << std::endl;
             std::cout << "  --quiet          Disable verbose logging" << std::endl;
             std::cout << "  --help           Show this help message" << std::endl;
             std::cout << std::endl;
@@ -70,12 +85,13 @@ int main(int argc, char* argv[]) {
         std::cout << std::endl;
         
         g_server->start();
-        
-        // Keep the main thread alive
-        // The server runs in its own thread
-        while (g_server->is_running()) {
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-        }
+
+        // Block until Ctrl+C (or stop()), then shut down cleanly:
+        // stop accepting, let in-flight generations drain, exit
+        g_server->wait_until_stopped();
+
+        std::cout << "\n[Main] Shutting down..." << std::endl;
+        g_server->stop();
         
     } catch (const std::exception& e) {
         std::cerr << "[Main] Error: " << e.what() << std::endl;
@@ -3,19 +3,302 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <chrono>
 #include <optional>
 #include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+
+// Forward declaration from curl.h (CURL really is a typedef for void,
+// so repeating it here keeps curl out of this header)
+typedef void CURL;
+
+// Forward declaration so stop() can reach the running server without
+// pulling all of httplib into this header
+namespace httplib { class Server; }
 
 namespace zeroconf {
 
+// ============================================================================
+// Logger - async structured logging (per-thread rings, background writer)
+// ============================================================================
+// std::cout << ... << std::endl inside a request handler flushes
+// synchronously and serializes every worker thread on the one stream -
+// measurably double-digit percent throughput once several workers log
+// per request. Here the hot path copies a fixed-size record into a
+// per-thread ring buffer (no lock, no syscall, no flush) and a single
+// background thread formats and writes everything out. Log lines stay
+// on in production at essentially zero cost to request latency.
+class Logger {
+public:
+    enum Level { kDebug = 0, kInfo = 1, kWarn = 2, kError = 3 };
+
+    // Process-wide instance, like Python's logging.getLogger()
+    static Logger& instance();
+
+    void set_level(Level level) { level_.store(level, std::memory_order_relaxed); }
+    bool enabled(Level level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+    // Queue one record. The tag must be a string literal (it is stored
+    // as a pointer); the message is truncated into a fixed slot. When
+    // the writer falls behind, records are dropped and counted rather
+    // than blocking the caller.
+    void log(Level level, const char* tag, const std::string& message);
+
+    // Start/stop the background writer. stop() drains what's queued.
+    void start();
+    void stop();
+
+private:
+    Logger() = default;
+
+    struct Record {
+        std::chrono::system_clock::time_point when;
+        int level;
+        const char* tag;
+        uint16_t length;
+        char text[230];
+    };
+
+    // Single-producer (the owning thread) / single-consumer (the
+    // writer) ring. Rings are registered once and kept for the life of
+    // the process - worker threads live as long as the server anyway.
+    struct Ring {
+        static constexpr size_t kSlots = 1024;  // Power of two
+        std::atomic<uint64_t> head{0};          // Next slot to fill
+        std::atomic<uint64_t> tail{0};          // Next slot to drain
+        Record slots[kSlots];
+    };
+
+    Ring* ring_for_this_thread();
+    void writer_loop();
+    size_t drain(Ring* ring);
+
+    std::atomic<int> level_{kInfo};
+    std::atomic<bool> running_{false};
+    std::thread writer_thread_;
+    std::mutex rings_mutex_;  // Guards registration only, never the hot path
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::atomic<uint64_t> dropped_{0};
+};
+
+// Call-site wrappers so logging reads as one line. The message string
+// is still built by the caller, so guard genuinely hot debug lines
+// with Logger::instance().enabled() when the build itself is costly.
+inline void log_debug(const char* tag, const std::string& msg) {
+    auto& logger = Logger::instance();
+    if (logger.enabled(Logger::kDebug)) logger.log(Logger::kDebug, tag, msg);
+}
+inline void log_info(const char* tag, const std::string& msg) {
+    auto& logger = Logger::instance();
+    if (logger.enabled(Logger::kInfo)) logger.log(Logger::kInfo, tag, msg);
+}
+inline void log_warn(const char* tag, const std::string& msg) {
+    auto& logger = Logger::instance();
+    if (logger.enabled(Logger::kWarn)) logger.log(Logger::kWarn, tag, msg);
+}
+inline void log_error(const char* tag, const std::string& msg) {
+    auto& logger = Logger::instance();
+    if (logger.enabled(Logger::kError)) logger.log(Logger::kError, tag, msg);
+}
+
+// ============================================================================
+// RequestArena - per-request monotonic scratch memory
+// ============================================================================
+// A single chat completion allocates dozens of times - request DOM,
+// rebuilt translation, dump strings, response DOM - all hitting the
+// global allocator and contending with every other worker thread.
+// The arena hands out memory by bumping a pointer through 64 KB
+// blocks and frees everything wholesale when the request is done:
+// allocation becomes an add, deallocation becomes free-the-blocks.
+class RequestArena {
+public:
+    RequestArena() = default;
+    ~RequestArena();
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+
+    // The arena active on this thread, if any. nlohmann default-
+    // constructs its allocators internally, so the binding travels in
+    // a thread-local rather than inside the allocator object.
+    static RequestArena*& current() {
+        thread_local RequestArena* active = nullptr;
+        return active;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+
+    static constexpr size_t kBlockBytes = 64 * 1024;
+    std::vector<Block> blocks_;
+};
+
+// Binds an arena to the current thread for one handler's scope,
+// restoring whatever was there before (like a context manager)
+struct ArenaScope {
+    RequestArena arena;
+    RequestArena* previous;
+
+    ArenaScope() : previous(RequestArena::current()) {
+        RequestArena::current() = &arena;
+    }
+    ~ArenaScope() {
+        RequestArena::current() = previous;
+    }
+};
+
+// std-compatible allocator drawing from the thread's active arena;
+// falls back to the global allocator when none is bound, so types
+// using it stay safe outside handler scope
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator() = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        if (auto* arena = RequestArena::current()) {
+            return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t) {
+        // Arena memory is reclaimed wholesale when the arena dies
+        if (!RequestArena::current()) {
+            ::operator delete(pointer);
+        }
+    }
+
+    bool operator==(const ArenaAllocator&) const { return true; }
+    bool operator!=(const ArenaAllocator&) const { return false; }
+};
+
+// ============================================================================
+// ConnectionPool - Reuses CURL easy handles (and their TCP connections)
+// ============================================================================
+// curl_easy_init()/curl_easy_cleanup() per request means a fresh TCP
+// handshake to the backend every time. A pooled handle keeps its
+// connection cache alive between requests, so repeat calls to the same
+// backend skip the handshake entirely (like requests.Session() in Python).
+class ConnectionPool {
+public:
+    ConnectionPool() = default;
+    ~ConnectionPool();
+
+    // Non-copyable - the pool owns raw CURL* handles
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Check out a handle for the given backend URL. Returns a freshly
+    // reset handle, either recycled from the pool or newly created.
+    CURL* acquire(const std::string& url);
+
+    // Return a handle after use. Pass reusable=false if the transfer
+    // failed - a handle with a broken connection is destroyed instead
+    // of being recycled.
+    void release(const std::string& url, CURL* handle, bool reusable);
+
+private:
+    // Pool key is the "scheme://host:port" part of a URL, so all
+    // endpoints on one backend share the same connections
+    static std::string backend_key(const std::string& url);
+
+    mutable std::mutex pool_mutex_;
+    std::map<std::string, std::vector<CURL*>> idle_handles_;
+
+    // Cap idle handles per backend so a traffic burst doesn't leave
+    // hundreds of sockets open forever
+    static constexpr size_t kMaxIdlePerBackend = 8;
+};
+
+// ============================================================================
+// TransferEngine - event-driven backend transfers on curl_multi
+// ============================================================================
+// A streaming generation used to pin a detached OS thread on a
+// blocking curl_easy_perform() for its whole lifetime - up to the
+// completion timeout. The engine instead drives all such transfers
+// from one event-loop thread on a curl_multi handle: a hundred live
+// streams cost one thread and a hundred sockets, not a hundred stacks
+// idle-waiting on the network.
+class TransferEngine {
+public:
+    // Per-transfer state; defined in the implementation file so curl
+    // types stay out of this header
+    struct Transfer;
+
+    // What a data callback wants done with the transfer. kDataPause
+    // parks it without consuming the buffer (libcurl re-delivers the
+    // same bytes on resume) so a slow client never blocks the loop -
+    // the other streams keep flowing while this one waits.
+    static constexpr int kDataContinue = 0;
+    static constexpr int kDataPause = 1;
+    static constexpr int kDataAbort = 2;
+
+    // Called on the event-loop thread as response bytes arrive;
+    // returns one of the kData* verdicts above
+    using DataFn = std::function<int(const char* data, size_t len)>;
+
+    // Called exactly once when the transfer ends, whether it
+    // succeeded, failed or was aborted
+    using DoneFn = std::function<void(bool success, long http_status)>;
+
+    // Polled about once a second even when no bytes are flowing;
+    // returning true aborts the transfer
+    using CancelFn = std::function<bool()>;
+
+    // Process-wide instance, same pattern as the connection pool
+    static TransferEngine& instance();
+
+    void start();
+    void stop();  // Aborts whatever is still in flight
+
+    // Queue a JSON POST and return immediately. All three callbacks
+    // run on the event-loop thread, so they must never block - answer
+    // kDataPause instead when the downstream side is full. Paused
+    // transfers are resumed on the next loop tick (within ~200 ms).
+    void submit_post(const std::string& url, std::string body,
+                     int timeout_seconds, DataFn on_data, DoneFn on_done,
+                     CancelFn cancelled);
+
+private:
+    TransferEngine() = default;
+
+    void event_loop();
+
+    std::mutex pending_mutex_;
+    std::vector<Transfer*> pending_;
+    std::atomic<bool> running_{false};
+    std::thread loop_thread_;
+    void* multi_ = nullptr;  // CURLM*, kept void* like the CURL typedef above
+};
+
 // ============================================================================
 // ServiceInfo - Represents a discovered ZeroconfAI service
 // ============================================================================
 // This is like a Python dataclass or named tuple
+// Which health-probe endpoint a backend answered last time. Once
+// known, a steady-state health check is a single request on a reused
+// connection; unknown (or stale) triggers a concurrent race of both.
+constexpr int kProbeUnknown = 0;
+constexpr int kProbeOllamaTags = 1;    // GET /api/tags
+constexpr int kProbeOpenAiModels = 2;  // GET /v1/models
+
 struct ServiceInfo {
     std::string name;          
     std::string address;       
@@ -24,11 +307,31 @@ struct ServiceInfo {
     int priority;              // Lower = higher priority (mDNS convention)
     std::chrono::system_clock::time_point last_seen;  // Like Python's datetime
     bool is_healthy;           // Health check status
-    
+    int consecutive_failures;  // Probe failures since the last success
+
+    // True when the backend answered /v1/models, i.e. it speaks the
+    // OpenAI API natively and requests can be passed through verbatim
+    // instead of translated to the Ollama dialect
+    bool openai_native;
+
+    // Models this backend reports as available, refreshed by health
+    // checks. Routing prefers a backend that already has the requested
+    // model so it doesn't have to cold-pull or swap it in.
+    std::set<std::string> models;
+
+    // Which probe endpoint answered last time (see kProbe* above)
+    int probe_endpoint;
+
+    // Operator-declared concurrent-request capacity, from the
+    // max_concurrent= mDNS TXT record (0 = unspecified)
+    int max_concurrent;
+
     // Constructor - similar to Python's __init__
     ServiceInfo(const std::string& name, const std::string& addr, int p, int prio = 50)
-        : name(name), address(addr), port(p), priority(prio), 
-          last_seen(std::chrono::system_clock::now()), is_healthy(false) {
+        : name(name), address(addr), port(p), priority(prio),
+          last_seen(std::chrono::system_clock::now()), is_healthy(false),
+          consecutive_failures(0), openai_native(false),
+          probe_endpoint(kProbeUnknown), max_concurrent(0) {
         url = "http://" + address + ":" + std::to_string(port);
     }
     
@@ -38,38 +341,373 @@ struct ServiceInfo {
     }
 };
 
+// ============================================================================
+// SharedServiceTable - one prober per host, many readers (opt-in)
+// ============================================================================
+// Several proxy instances on one workstation each probing the whole
+// fleet multiplies discovery and health traffic for no benefit. With
+// the shared table enabled, the first instance to grab the election
+// lock runs discovery/health and publishes the table into a POSIX
+// shared-memory segment; the others attach and just read it. Records
+// are fixed-size and the segment is seqlock-protected, so reads are a
+// couple of memory copies - no lock, no syscall.
+class SharedServiceTable {
+public:
+    static constexpr size_t kMaxServices = 64;
+
+    SharedServiceTable() = default;
+    ~SharedServiceTable();
+
+    SharedServiceTable(const SharedServiceTable&) = delete;
+    SharedServiceTable& operator=(const SharedServiceTable&) = delete;
+
+    // Maps the segment and runs the owner election (non-blocking
+    // flock). Returns false if shared memory is unavailable - callers
+    // should fall back to a private table.
+    bool attach();
+    bool is_owner() const { return owner_; }
+
+    // Owner side: publish the full table (healthy or not)
+    void write_services(const std::vector<ServiceInfo>& services);
+
+    // Reader side: seqlock-consistent copy of the table. Returns
+    // false if a stable read could not be obtained.
+    bool read_services(std::vector<ServiceInfo>& out) const;
+
+private:
+    struct Layout;  // Fixed-size wire format, defined in the .cpp
+
+    Layout* layout_ = nullptr;
+    int shm_fd_ = -1;
+    int lock_fd_ = -1;
+    bool owner_ = false;
+};
+
 // ============================================================================
 // ServiceDiscovery - Discovers and tracks ZeroconfAI services via mDNS
 // ============================================================================
 class ServiceDiscovery {
 public:
-    ServiceDiscovery();
+    // Immutable, pre-sorted view of the healthy services. Readers
+    // share it by reference count; writers publish a replacement
+    // instead of mutating (read-copy-update, like persistent
+    // data structures in functional languages)
+    using ServiceSnapshot = std::shared_ptr<const std::vector<ServiceInfo>>;
+
+    // use_shared_table opts into the one-prober-per-host shared
+    // memory mode (see SharedServiceTable)
+    explicit ServiceDiscovery(bool use_shared_table = false);
     ~ServiceDiscovery();
-    
+
     void start();
     void stop();
-    
+
     // Get all healthy services, sorted by priority
     std::vector<ServiceInfo> get_services() const;
-    
+
     // Get best (highest priority) healthy service
     std::optional<ServiceInfo> get_best_service() const;
-    
+
+    // Hot-path accessor: one atomic load, no lock, no allocation.
+    // The request handlers use this; the returned vector never changes.
+    ServiceSnapshot get_snapshot() const;
+
+    // Total tracked services including unhealthy ones (gauge for /metrics)
+    size_t total_service_count() const;
+
+    // Harness hook (used by zeroconfai_bench): seed a known backend
+    // directly instead of waiting for mDNS to find it
+    void inject_service(ServiceInfo info);
+
+    // Called by the proxy when a forward to this backend fails. Feeds
+    // the same consecutive-failure accounting as the prober, so a dead
+    // backend leaves rotation on live traffic evidence instead of
+    // waiting for the next health pass to notice.
+    void report_forward_failure(const std::string& name);
+
 private:
     void discovery_loop();
+    void legacy_polling_loop();
     void health_check_loop();
-    bool check_health(const std::string& url);
-    
-    // Thread-safe storage - like threading.Lock() in Python
+    void shared_reader_loop();
+    bool check_health(const std::string& url, int& probe_endpoint,
+                      bool& openai_native, std::set<std::string>& models);
+
+    // Warm-start cache: the last published table mirrored into a
+    // small mmap'd file, reloaded instantly on the next startup so a
+    // restarted proxy routes before the first discovery pass finishes
+    void load_warm_start();
+    void save_warm_start();
+
+    // Shared by the mDNS callbacks and the legacy polling fallback
+    void add_or_update_service(const ServiceInfo& info);
+    void remove_service(const std::string& name);
+
+    // The Avahi event-loop implementation lives in the .cpp and calls
+    // back into the private service-table helpers above
+    friend struct AvahiDiscovery;
+
+
+    // Rebuilds and atomically publishes the read snapshot. Must be
+    // called with services_mutex_ held, after any change to services_.
+    void publish_snapshot();
+
+    // Thread-safe storage - like threading.Lock() in Python.
+    // The mutex only serializes writers (discovery and health threads);
+    // request-path readers go through snapshot_ without locking.
     mutable std::mutex services_mutex_;
     std::map<std::string, ServiceInfo> services_;
+    ServiceSnapshot snapshot_;
     
+    // Opt-in shared-memory mode (see SharedServiceTable). When this
+    // instance is a reader, the only background thread is
+    // shared_reader_loop() and no probing happens at all.
+    bool use_shared_table_;
+    SharedServiceTable shared_table_;
+    void* warm_start_map_ = nullptr;  // WarmStartLayout*, see the .cpp
+
     // Background threads
     std::thread discovery_thread_;
     std::thread health_thread_;
     std::atomic<bool> running_;  // Thread-safe bool
 };
 
+// ============================================================================
+// Metrics - hot-path counters exposed as Prometheus text at /metrics
+// ============================================================================
+// Counting a request is a handful of relaxed atomic increments -
+// nanoseconds, safe to leave on in production. All formatting happens
+// at scrape time, never on the request path.
+class Metrics {
+public:
+    enum Route { kRouteHealth = 0, kRouteModels, kRouteCompletions, kRouteEmbeddings, kRouteCount };
+
+    // Called by the handlers when a request finishes
+    void record_request(Route route, long latency_us, bool error);
+
+    // Called when a forward to a backend fails
+    void record_backend_error(const std::string& backend_name);
+
+    // Renders the Prometheus exposition format
+    std::string render(size_t services_discovered, size_t services_healthy,
+                       const std::map<std::string, int>& backend_inflight) const;
+
+    static const char* route_name(Route route);
+
+private:
+    // Histogram bucket upper bounds, in microseconds
+    static constexpr long kBucketBoundsUs[] =
+        {1000, 10000, 100000, 1000000, 10000000, 60000000};
+    static constexpr size_t kNumBuckets =
+        sizeof(kBucketBoundsUs) / sizeof(kBucketBoundsUs[0]);
+
+    struct RouteStats {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> latency_sum_us{0};
+        std::atomic<uint64_t> buckets[kNumBuckets]{};  // Cumulative at render time
+    };
+
+    RouteStats routes_[kRouteCount];
+
+    // Error counts keyed by backend name. Only touched when a backend
+    // actually fails, so a mutex is fine here.
+    mutable std::mutex backend_mutex_;
+    std::map<std::string, uint64_t> backend_errors_;
+};
+
+// ============================================================================
+// ModelsCache - TTL cache with single-flight fetch coalescing
+// ============================================================================
+// Model lists change roughly never, but Jan polls /v1/models
+// aggressively. Cache the already-converted response string per
+// backend, and when several requests miss at once, let one of them do
+// the upstream fetch while the rest wait for its result instead of
+// stampeding the backend.
+class ModelsCache {
+public:
+    // Returns the cached value if still fresh; otherwise runs fetch()
+    // (exactly once per key across concurrent callers) and caches its
+    // result. fetch() returning an empty string means failure - then
+    // a stale cached value is served if one exists.
+    std::string get_or_fetch(const std::string& key,
+                             int ttl_seconds,
+                             const std::function<std::string()>& fetch);
+
+private:
+    struct Entry {
+        std::string body;
+        std::chrono::steady_clock::time_point expires{};
+        bool fetch_in_progress = false;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable fetch_done_;
+    std::map<std::string, Entry> entries_;
+};
+
+// ============================================================================
+// CompletionCache - content-addressed replies for deterministic requests
+// ============================================================================
+// Internal tools replay identical prompts constantly - temperature 0,
+// same system prompt, same few-shot examples - and every replay costs
+// a full 5-30 s GPU generation. Deterministic requests are hashed by
+// their normalized content (model + messages + sampling params) and
+// the finished response is kept under an LRU bound with a TTL, so a
+// replay is a microsecond map lookup instead of a generation. Opt-in
+// via ProxyConfig::enable_completion_cache.
+class CompletionCache {
+public:
+    explicit CompletionCache(size_t max_entries) : max_entries_(max_entries) {}
+
+    // Returns the stored response, or nullopt on a miss or expiry
+    std::optional<std::string> get(uint64_t key);
+
+    // Stores a finished response, evicting least recently used
+    // entries beyond the capacity bound
+    void put(uint64_t key, std::string response, int ttl_seconds);
+
+private:
+    struct Entry {
+        std::string response;
+        std::chrono::steady_clock::time_point expires;
+        std::list<uint64_t>::iterator lru_position;
+    };
+
+    std::mutex mutex_;
+    std::map<uint64_t, Entry> entries_;
+    std::list<uint64_t> lru_;  // Front = most recently used
+    size_t max_entries_;
+};
+
+// ============================================================================
+// Router - Load-aware backend selection
+// ============================================================================
+// Sits between ProxyServer and ServiceDiscovery. Discovery says which
+// backends exist; the router decides which one gets the next request,
+// based on how much work each backend already has in flight and how
+// fast it has been completing recently. Within the best priority tier
+// it uses power-of-two-choices: sample two backends at random, send
+// the request to the less loaded one - near-optimal balance without
+// global coordination.
+class Router {
+public:
+    // default_max_concurrent caps in-flight forwards per backend when
+    // its TXT record doesn't declare max_concurrent (0 = uncapped)
+    explicit Router(std::shared_ptr<ServiceDiscovery> discovery,
+                    int default_max_concurrent = 0);
+
+    // Pick a backend for a new request. When the requested model is
+    // known, backends that already host it are preferred; otherwise
+    // (or if nobody hosts it) selection falls back to the whole pool.
+    // Returns nullopt when no healthy service exists.
+    std::optional<ServiceInfo> select_backend(const std::string& model = std::string());
+
+    // Admission-controlled pick for generations: like select_backend,
+    // but a slot on the returned backend is reserved (counted against
+    // its concurrency limit) before returning, and backends already
+    // running at their limit are spilled past to one with room. When
+    // every candidate is saturated the call waits up to wait_ms for a
+    // slot, then gives up. On success the caller owns the slot and
+    // must release it with exactly one on_request_finish.
+    std::optional<ServiceInfo> acquire_backend(const std::string& model,
+                                               int wait_ms);
+
+    // Accounting hooks, called by the request handlers around each
+    // forward. latency is only folded into the moving average on
+    // success so a fast-failing backend doesn't look attractive.
+    void on_request_start(const std::string& backend_name);
+    void on_request_finish(const std::string& backend_name,
+                           long latency_ms, bool success);
+
+    // Current in-flight count for a backend (for /v1/health reporting)
+    int inflight(const std::string& backend_name) const;
+
+    // All current in-flight counts, for the /metrics scrape
+    std::map<std::string, int> inflight_counts() const;
+
+private:
+    // Per-backend counters. Atomics so the handlers update them
+    // without taking stats_mutex_ (that lock only guards the map)
+    struct BackendStats {
+        std::atomic<int> inflight{0};
+        std::atomic<long> ewma_latency_ms{0};  // 0 = no data yet
+    };
+
+    std::shared_ptr<BackendStats> stats_for(const std::string& backend_name);
+
+    // True if lhs has strictly less outstanding work than rhs
+    static bool less_loaded(const BackendStats& lhs, const BackendStats& rhs);
+
+    // Effective concurrency limit for one backend: its TXT-declared
+    // max_concurrent, else the configured default (0 = uncapped)
+    int limit_for(const ServiceInfo& backend) const;
+
+    // Reserve one slot on backend if it is under its limit
+    bool try_reserve(const ServiceInfo& backend);
+
+    std::shared_ptr<ServiceDiscovery> discovery_;
+    int default_max_concurrent_;
+
+    mutable std::mutex stats_mutex_;
+    std::map<std::string, std::shared_ptr<BackendStats>> stats_;
+
+    // Admission waiters park here; on_request_finish wakes them when
+    // a slot frees up
+    std::mutex admission_mutex_;
+    std::condition_variable admission_cv_;
+};
+
+// ============================================================================
+// EmbeddingBatcher - coalesces embedding requests into one backend call
+// ============================================================================
+// Indexing jobs embed thousands of chunks as separate HTTP requests;
+// each one costs the backend a full request cycle for milliseconds of
+// actual compute. Requests for the same model arriving within a short
+// window are merged into one batched backend call and the results are
+// split back per caller - the first caller for a model becomes the
+// batch leader, holds the window open, dispatches, and wakes the rest.
+class EmbeddingBatcher {
+public:
+    EmbeddingBatcher(std::shared_ptr<ServiceDiscovery> discovery,
+                     std::shared_ptr<Router> router)
+        : discovery_(std::move(discovery)), router_(std::move(router)) {}
+
+    // Blocks until the batch containing these inputs completes.
+    // Returns the HTTP status and this caller's share of the results,
+    // already in OpenAI embeddings format.
+    std::pair<int, std::string> embed(const std::string& model,
+                                      std::vector<std::string> inputs,
+                                      int window_ms, int timeout_seconds);
+
+private:
+    // One caller's slice of a batch
+    struct PendingCall {
+        size_t offset = 0;  // Position of this caller's inputs in the merged array
+        size_t count = 0;
+        bool done = false;
+        int status = 0;
+        std::string response;
+    };
+
+    // A batch still collecting callers
+    struct OpenBatch {
+        std::string model;
+        std::vector<std::string> inputs;
+        std::vector<std::shared_ptr<PendingCall>> calls;
+    };
+
+    void dispatch(OpenBatch& batch, int timeout_seconds);
+    void fail_batch(OpenBatch& batch, int status, const std::string& message);
+
+    std::shared_ptr<ServiceDiscovery> discovery_;
+    std::shared_ptr<Router> router_;
+
+    std::mutex mutex_;
+    std::condition_variable done_cv_;
+    std::map<std::string, std::shared_ptr<OpenBatch>> open_batches_;  // By model
+};
+
 // ============================================================================
 // ProxyConfig - Configuration for the proxy server
 // ============================================================================
@@ -78,6 +716,70 @@ struct ProxyConfig {
     int port = 8080;
     bool enable_cors = true;
     bool verbose = false;
+
+    // HTTP worker pool. Generations block a worker for their whole
+    // duration, so this bounds how many run concurrently; the queue
+    // bounds how many connections may wait for a worker.
+    int worker_threads = 8;
+    int max_queued_requests = 64;
+
+    // Completions beyond this many in flight are shed with 503 +
+    // Retry-After, keeping workers free so the cheap routes
+    // (/v1/health, /v1/models) never sit behind slow generations.
+    // Defaults to worker_threads - 2 when <= 0.
+    int max_inflight_completions = 0;
+
+    // How long a fetched /v1/models response stays valid
+    int models_cache_ttl_seconds = 30;
+
+    // Share one discovery/health prober between all proxy instances
+    // on this host via shared memory (see SharedServiceTable)
+    bool use_shared_service_table = false;
+
+    // How long stop() waits for in-flight generations to finish
+    // before giving up on them
+    int drain_timeout_seconds = 10;
+
+    // Largest request body accepted (413 beyond this). Conversation
+    // histories are big but bounded; nothing legitimate needs more.
+    size_t max_request_body_bytes = 8 * 1024 * 1024;
+
+    // Total budget for retrying a failed completion on other backends
+    // before answering 502
+    int failover_deadline_seconds = 30;
+
+    // Upper bound on a single backend forward. Client disconnect
+    // aborts the transfer much sooner (see curl_cancel_callback);
+    // this is the backstop for a backend that just never finishes.
+    int completion_timeout_seconds = 120;
+
+    // When set, also listen on this Unix domain socket. Same-host
+    // clients connecting here skip the loopback TCP stack (fewer
+    // syscalls and copies per request, no ephemeral-port exhaustion
+    // under heavy short-request load).
+    std::string unix_socket_path;
+
+    // How long the first embeddings caller for a model holds the
+    // batch window open for others to join
+    int embeddings_batch_window_ms = 5;
+
+    // Per-backend concurrency cap for generations, used when a
+    // backend's TXT record doesn't declare max_concurrent. Ollama
+    // runs OLLAMA_NUM_PARALLEL (default 4) generations in parallel
+    // and swap-thrashes beyond that, so pushing more at one box only
+    // inflates its queue. 0 = uncapped.
+    int backend_max_concurrent = 4;
+
+    // How long a completion may wait for a backend slot to open up
+    // before being shed with 503 (the "short bounded queue")
+    int admission_wait_ms = 250;
+
+    // Serve repeated deterministic (temperature 0, non-streaming)
+    // completions from a content-addressed cache instead of paying a
+    // generation per replay
+    bool enable_completion_cache = false;
+    size_t completion_cache_max_entries = 256;
+    int completion_cache_ttl_seconds = 300;
 };
 
 // ============================================================================
@@ -89,16 +791,63 @@ public:
     ~ProxyServer();
     
     void start();
+
+    // Drain-based shutdown: stop accepting, wait for in-flight
+    // forwards up to drain_timeout_seconds, then tear down
     void stop();
+
     bool is_running() const { return running_.load(); }
+
+    // Harness hook (used by zeroconfai_bench) - reaches the discovery
+    // behind this proxy, e.g. to inject a mock backend
+    std::shared_ptr<ServiceDiscovery> discovery() const { return discovery_; }
+
+    // Async-signal-safe stop request (just an atomic store) - the
+    // signal handler calls this, and main() runs the real stop()
+    void request_stop() { stop_requested_.store(true); }
+
+    // Blocks the main thread until request_stop() or stop()
+    void wait_until_stopped() const;
     
 private:
     ProxyConfig config_;
     std::shared_ptr<ServiceDiscovery> discovery_;  // Like Python's shared reference
+    std::shared_ptr<Router> router_;
+    ModelsCache models_cache_;
+    CompletionCache completion_cache_;
+    std::shared_ptr<EmbeddingBatcher> embedding_batcher_;
+    Metrics metrics_;
     std::atomic<bool> running_;
     std::thread server_thread_;
-    
+
+    // How many completions are being generated right now - used for
+    // overload shedding, so a burst can't occupy every worker
+    std::atomic<int> inflight_completions_;
+
+    // Constructed in start() before their listener threads exist, so
+    // stop() can always reach Server::stop() and break the accept
+    // loop - a stop() racing a just-spawned listener thread must not
+    // miss the pointer and hang in join() forever
+    std::unique_ptr<httplib::Server> http_server_;
+    std::unique_ptr<httplib::Server> uds_server_;
+    std::thread uds_thread_;
+    std::atomic<bool> stop_requested_{false};
+
+    // Armed by stop() before it waits for anything: buffered forwards
+    // poll shutdown_drain_expired() through their cancel callback, so
+    // shutdown is bounded by drain_timeout_seconds even when a
+    // backend would happily generate for completion_timeout_seconds
+    std::atomic<bool> shutting_down_{false};
+    std::chrono::steady_clock::time_point shutdown_deadline_;
+    bool shutdown_drain_expired() const;
+
     void run_server();
+    void run_unix_server();
+
+    // Registers limits, CORS and every route - shared by the TCP and
+    // the Unix-socket listeners
+    void configure_routes(httplib::Server& server);
+    int completion_capacity() const;
 };
 
 } // namespace zeroconf
\ No newline at end of file
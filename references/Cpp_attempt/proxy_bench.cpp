@@ -0,0 +1,281 @@
+// ============================================================================
+// zeroconfai_bench - load-test and micro-benchmark harness for the proxy
+// ============================================================================
+// Stands up a mock Ollama backend in-process, points a real ProxyServer
+// at it, drives N concurrent clients through the real routes, and
+// reports latency percentiles and throughput. This is how a change to
+// the proxy gets measured before it gets deployed.
+//
+//   ./zeroconfai_bench [--clients N] [--requests M] [--delay-ms D]
+//
+// The mock backend answers /api/chat after D ms, standing in for
+// generation time, so queueing behaviour shows up at realistic delays.
+
+#include "local_proxy_client.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr int kMockBackendPort = 18434;
+constexpr int kProxyPort = 18080;
+
+// ----------------------------------------------------------------------------
+// Percentile reporting
+// ----------------------------------------------------------------------------
+
+long percentile_us(std::vector<long>& samples, double p) {
+    if (samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t index = static_cast<size_t>(p * (samples.size() - 1));
+    return samples[index];
+}
+
+void report(const std::string& label, std::vector<long>& latencies_us,
+            double elapsed_seconds) {
+    std::cout << "  " << label << ": "
+              << latencies_us.size() << " requests, "
+              << static_cast<long>(latencies_us.size() / elapsed_seconds) << " req/s, "
+              << "p50 " << percentile_us(latencies_us, 0.50) / 1000.0 << " ms, "
+              << "p95 " << percentile_us(latencies_us, 0.95) / 1000.0 << " ms, "
+              << "p99 " << percentile_us(latencies_us, 0.99) / 1000.0 << " ms"
+              << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// Mock Ollama backend
+// ----------------------------------------------------------------------------
+// Canned responses with a configurable per-request delay standing in
+// for generation time
+
+void run_mock_backend(httplib::Server& backend, int delay_ms) {
+    backend.Get("/api/tags", [](const httplib::Request&, httplib::Response& res) {
+        json tags = {
+            {"models", json::array({
+                {{"name", "bench-model:latest"}}
+            })}
+        };
+        res.set_content(tags.dump(), "application/json");
+    });
+
+    backend.Post("/api/chat", [delay_ms](const httplib::Request&, httplib::Response& res) {
+        if (delay_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        }
+        json reply = {
+            {"model", "bench-model:latest"},
+            {"message", {{"role", "assistant"}, {"content", "benchmark response"}}},
+            {"done", true}
+        };
+        res.set_content(reply.dump(), "application/json");
+    });
+
+    backend.listen("127.0.0.1", kMockBackendPort);
+}
+
+// ----------------------------------------------------------------------------
+// Client load generator
+// ----------------------------------------------------------------------------
+
+enum class BenchRoute { kHealth, kModels, kCompletions };
+
+void drive_route(BenchRoute route, int clients, int requests_per_client,
+                 std::vector<long>& all_latencies_us) {
+    std::vector<std::vector<long>> per_client(clients);
+    std::vector<std::thread> threads;
+
+    json completion_request = {
+        {"model", "bench-model:latest"},
+        {"messages", json::array({
+            {{"role", "user"}, {"content", "Say something for the benchmark."}}
+        })},
+        {"stream", false}
+    };
+    std::string completion_body = completion_request.dump();
+
+    for (int c = 0; c < clients; c++) {
+        threads.emplace_back([route, requests_per_client, &per_client, &completion_body, c]() {
+            httplib::Client client("127.0.0.1", kProxyPort);
+            client.set_keep_alive(true);
+            client.set_read_timeout(120);
+
+            for (int i = 0; i < requests_per_client; i++) {
+                auto started = Clock::now();
+
+                httplib::Result result;
+                switch (route) {
+                    case BenchRoute::kHealth:
+                        result = client.Get("/v1/health");
+                        break;
+                    case BenchRoute::kModels:
+                        result = client.Get("/v1/models");
+                        break;
+                    case BenchRoute::kCompletions:
+                        result = client.Post("/v1/chat/completions",
+                                             completion_body, "application/json");
+                        break;
+                }
+
+                auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - started).count();
+
+                // Shed requests (503) still count as observed latency;
+                // transport failures don't
+                if (result) {
+                    per_client[c].push_back(elapsed_us);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& latencies : per_client) {
+        all_latencies_us.insert(all_latencies_us.end(),
+                                latencies.begin(), latencies.end());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Micro-benchmarks
+// ----------------------------------------------------------------------------
+
+void micro_benchmarks(const std::shared_ptr<zeroconf::ServiceDiscovery>& discovery) {
+    std::cout << "Micro-benchmarks:" << std::endl;
+
+    // Service lookup - the per-request routing cost
+    {
+        constexpr int kIterations = 1000000;
+        volatile size_t sink = 0;
+        auto started = Clock::now();
+        for (int i = 0; i < kIterations; i++) {
+            sink += discovery->get_snapshot()->size();
+        }
+        auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - started).count();
+        std::cout << "  get_snapshot(): " << elapsed_ns / kIterations
+                  << " ns/op" << std::endl;
+    }
+
+    // JSON translation - the parse/rebuild/serialize round-trip the
+    // Ollama-dialect forwarding path pays per request
+    {
+        json request = {
+            {"model", "bench-model:latest"},
+            {"messages", json::array({
+                {{"role", "system"}, {"content", std::string(2048, 'x')}},
+                {{"role", "user"}, {"content", std::string(512, 'y')}}
+            })},
+            {"stream", false}
+        };
+        std::string body = request.dump();
+
+        constexpr int kIterations = 10000;
+        auto started = Clock::now();
+        for (int i = 0; i < kIterations; i++) {
+            auto parsed = json::parse(body);
+            json translated = {
+                {"model", parsed.value("model", "llama2")},
+                {"messages", parsed["messages"]},
+                {"stream", parsed.value("stream", false)}
+            };
+            volatile size_t sink = translated.dump().size();
+            (void)sink;
+        }
+        auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - started).count();
+        std::cout << "  JSON translate (2.5 KB body): " << elapsed_us / kIterations
+                  << " us/op" << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int clients = 8;
+    int requests_per_client = 50;
+    int delay_ms = 20;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--clients" && i + 1 < argc) {
+            clients = std::stoi(argv[++i]);
+        } else if (arg == "--requests" && i + 1 < argc) {
+            requests_per_client = std::stoi(argv[++i]);
+        } else if (arg == "--delay-ms" && i + 1 < argc) {
+            delay_ms = std::stoi(argv[++i]);
+        } else if (arg == "--help") {
+            std::cout << "Usage: " << argv[0]
+                      << " [--clients N] [--requests M] [--delay-ms D]" << std::endl;
+            return 0;
+        }
+    }
+
+    std::cout << "zeroconfai_bench: " << clients << " clients x "
+              << requests_per_client << " requests, "
+              << delay_ms << " ms mock generation delay" << std::endl;
+
+    // Mock backend first, so the proxy has something to route to
+    httplib::Server backend;
+    std::thread backend_thread(run_mock_backend, std::ref(backend), delay_ms);
+    backend.wait_until_ready();
+
+    // Real proxy, pointed at the mock via the injection hook instead
+    // of waiting for mDNS
+    zeroconf::ProxyConfig config;
+    config.host = "127.0.0.1";
+    config.port = kProxyPort;
+    config.verbose = false;
+    config.worker_threads = clients + 2;
+    config.max_inflight_completions = clients;
+
+    zeroconf::ProxyServer proxy(config);
+    proxy.start();
+    proxy.discovery()->inject_service(
+        zeroconf::ServiceInfo("mock-backend", "127.0.0.1", kMockBackendPort, 10));
+
+    // Give the listener a moment to come up
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::cout << "Routes:" << std::endl;
+    {
+        std::vector<long> latencies;
+        auto started = Clock::now();
+        drive_route(BenchRoute::kHealth, clients, requests_per_client, latencies);
+        double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+        report("/v1/health          ", latencies, elapsed);
+    }
+    {
+        std::vector<long> latencies;
+        auto started = Clock::now();
+        drive_route(BenchRoute::kModels, clients, requests_per_client, latencies);
+        double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+        report("/v1/models          ", latencies, elapsed);
+    }
+    {
+        std::vector<long> latencies;
+        auto started = Clock::now();
+        drive_route(BenchRoute::kCompletions, clients, requests_per_client, latencies);
+        double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+        report("/v1/chat/completions", latencies, elapsed);
+    }
+
+    micro_benchmarks(proxy.discovery());
+
+    proxy.stop();
+    backend.stop();
+    backend_thread.join();
+
+    return 0;
+}
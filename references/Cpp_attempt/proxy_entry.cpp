@@ -2,12 +2,37 @@
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <deque>
+#include <condition_variable>
+#include <random>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
 
 // Third-party libraries
 #include <httplib.h>           // cpp-httplib for HTTP server (header-only)
 #include <nlohmann/json.hpp>   // JSON library (header-only)
 #include <curl/curl.h>         // libcurl for HTTP client
 
+// SSE2/NEON for the streaming NDJSON splitter's newline scan
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// POSIX shared memory and file locking for the shared service table,
+// AF_UNIX for the same-host listener
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
 // Avahi (Linux) or dns_sd (macOS) for mDNS service discovery
 #ifdef __APPLE__
     #include <dns_sd.h>
@@ -16,12 +41,240 @@
     #include <avahi-client/lookup.h>
     #include <avahi-common/simple-watch.h>
     #include <avahi-common/error.h>
+    #include <avahi-common/malloc.h>
 #endif
 
 using json = nlohmann::json;
 
 namespace zeroconf {
 
+// json whose internal nodes draw from the thread's active RequestArena
+// (see ArenaScope in the header). The completions handler binds an
+// arena for its scope, so its parse/translate/convert DOM work turns
+// into bump-pointer allocations freed wholesale with the request.
+using arena_json = nlohmann::basic_json<std::map, std::vector, std::string, bool,
+                                        std::int64_t, std::uint64_t, double,
+                                        ArenaAllocator>;
+
+// ============================================================================
+// RequestArena Implementation
+// ============================================================================
+
+RequestArena::~RequestArena() {
+    for (auto& block : blocks_) {
+        ::operator delete(block.data);
+    }
+}
+
+void* RequestArena::allocate(size_t bytes, size_t alignment) {
+    if (!blocks_.empty()) {
+        Block& block = blocks_.back();
+        size_t aligned = (block.used + alignment - 1) & ~(alignment - 1);
+        if (aligned + bytes <= block.size) {
+            block.used = aligned + bytes;
+            return block.data + aligned;
+        }
+    }
+
+    // New block; oversized requests get one of their own
+    Block block;
+    block.size = std::max(kBlockBytes, bytes);
+    block.data = static_cast<char*>(::operator new(block.size));
+    block.used = bytes;  // operator new is max-aligned already
+    blocks_.push_back(block);
+    return blocks_.back().data;
+}
+
+// ============================================================================
+// Logger Implementation
+// ============================================================================
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Ring* Logger::ring_for_this_thread() {
+    thread_local Ring* ring = nullptr;
+    if (!ring) {
+        auto owned = std::make_unique<Ring>();
+        ring = owned.get();
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::move(owned));
+    }
+    return ring;
+}
+
+void Logger::log(Level level, const char* tag, const std::string& message) {
+    Ring* ring = ring_for_this_thread();
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= Ring::kSlots) {
+        // The writer has fallen behind; dropping a log line beats
+        // blocking a worker thread on I/O
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record& record = ring->slots[head % Ring::kSlots];
+    record.when = std::chrono::system_clock::now();
+    record.level = level;
+    record.tag = tag;
+    record.length = static_cast<uint16_t>(
+        std::min(message.size(), sizeof(record.text)));
+    std::memcpy(record.text, message.data(), record.length);
+
+    // Publish after the slot is fully written
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+size_t Logger::drain(Ring* ring) {
+    static const char* kLevelNames[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+    size_t written = 0;
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+
+    while (tail != head) {
+        const Record& record = ring->slots[tail % Ring::kSlots];
+
+        auto seconds = std::chrono::system_clock::to_time_t(record.when);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            record.when.time_since_epoch()).count() % 1000;
+        std::tm tm_buf{};
+        localtime_r(&seconds, &tm_buf);
+
+        char line[320];
+        int length = std::snprintf(line, sizeof(line),
+                                   "%02d:%02d:%02d.%03d %s [%s] %.*s\n",
+                                   tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
+                                   static_cast<int>(millis),
+                                   kLevelNames[record.level], record.tag,
+                                   static_cast<int>(record.length), record.text);
+        if (length > 0) {
+            std::fwrite(line, 1, static_cast<size_t>(length), stdout);
+        }
+        written++;
+        tail++;
+    }
+
+    ring->tail.store(tail, std::memory_order_release);
+    return written;
+}
+
+void Logger::start() {
+    if (running_.exchange(true)) return;
+    writer_thread_ = std::thread(&Logger::writer_loop, this);
+}
+
+void Logger::stop() {
+    if (!running_.exchange(false)) return;
+    if (writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
+}
+
+void Logger::writer_loop() {
+    while (true) {
+        // Read the flag before sweeping, so the sweep after stop()
+        // drains everything queued up to that point
+        bool keep_going = running_.load(std::memory_order_relaxed);
+
+        size_t written = 0;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            for (auto& ring : rings_) {
+                written += drain(ring.get());
+            }
+        }
+        if (written > 0) {
+            std::fflush(stdout);
+        }
+
+        if (!keep_going) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    uint64_t dropped = dropped_.exchange(0);
+    if (dropped > 0) {
+        std::fprintf(stdout, "WARN  [Logger] %llu record(s) dropped (writer fell behind)\n",
+                     static_cast<unsigned long long>(dropped));
+        std::fflush(stdout);
+    }
+}
+
+// ============================================================================
+// ConnectionPool Implementation
+// ============================================================================
+
+std::string ConnectionPool::backend_key(const std::string& url) {
+    // "http://127.0.0.1:11434/api/chat" -> "http://127.0.0.1:11434"
+    // Find the first '/' after the "://" separator
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string::npos) {
+        return url;  // Not a normal URL - use it verbatim
+    }
+    auto path_start = url.find('/', scheme_end + 3);
+    if (path_start == std::string::npos) {
+        return url;  // No path component
+    }
+    return url.substr(0, path_start);
+}
+
+CURL* ConnectionPool::acquire(const std::string& url) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        auto it = idle_handles_.find(backend_key(url));
+        if (it != idle_handles_.end() && !it->second.empty()) {
+            CURL* handle = it->second.back();
+            it->second.pop_back();
+            return handle;
+        }
+    }
+
+    // Pool miss - create a new handle. It joins the pool on release.
+    return curl_easy_init();
+}
+
+void ConnectionPool::release(const std::string& url, CURL* handle, bool reusable) {
+    if (!handle) return;
+
+    if (!reusable) {
+        // The transfer failed; the cached connection may be broken
+        curl_easy_cleanup(handle);
+        return;
+    }
+
+    // Reset options but keep the handle's connection cache alive -
+    // that cache is the whole point of pooling
+    curl_easy_reset(handle);
+
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    auto& idle = idle_handles_[backend_key(url)];
+    if (idle.size() >= kMaxIdlePerBackend) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    idle.push_back(handle);
+}
+
+ConnectionPool::~ConnectionPool() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    for (auto& [key, handles] : idle_handles_) {
+        for (CURL* handle : handles) {
+            curl_easy_cleanup(handle);
+        }
+    }
+    idle_handles_.clear();
+}
+
+// Process-wide pool shared by the proxy handlers and the health checks.
+// Function-local static so construction order is well-defined.
+static ConnectionPool& connection_pool() {
+    static ConnectionPool pool;
+    return pool;
+}
+
 // ============================================================================
 // CURL Utilities - HTTP client for forwarding requests and health checks
 // ============================================================================
@@ -34,245 +287,2352 @@ static size_t curl_write_callback(void* contents, size_t size, size_t nmemb, std
     return total_size;
 }
 
-// Simple HTTP GET using libcurl - like requests.get() in Python
+// Header callback that pre-sizes the response buffer from
+// Content-Length, so the body lands in one allocation instead of
+// growing through O(log n) reallocate-and-copy cycles. Capped so a
+// hostile header can't make us reserve gigabytes.
+static size_t curl_header_reserve_callback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    constexpr size_t kMaxReserveBytes = 64 * 1024 * 1024;
+
+    size_t total_size = size * nitems;
+    auto* output = static_cast<std::string*>(userdata);
+
+    // Case-insensitive "content-length:" match
+    constexpr char kPrefix[] = "content-length:";
+    constexpr size_t kPrefixLen = sizeof(kPrefix) - 1;
+    if (total_size > kPrefixLen) {
+        size_t i = 0;
+        for (; i < kPrefixLen; i++) {
+            if (std::tolower(static_cast<unsigned char>(buffer[i])) != kPrefix[i]) break;
+        }
+        if (i == kPrefixLen) {
+            size_t length = std::strtoull(buffer + kPrefixLen, nullptr, 10);
+            if (length > 0 && length <= kMaxReserveBytes) {
+                output->reserve(length);
+            }
+        }
+    }
+    return total_size;
+}
+
+// ----------------------------------------------------------------------------
+// Shared connection cache
+// ----------------------------------------------------------------------------
+// Every pooled easy handle used to keep its own private connection
+// cache, so a health probe and a forward to the same backend each held
+// (and re-opened) their own sockets. A process-wide curl share object
+// with CURL_LOCK_DATA_CONNECT gives all handles - the blocking
+// http_get/http_post ones and the TransferEngine's - one common cache:
+// a probe rides whatever warm connection the last forward left behind,
+// and an HTTP/2 connection in the cache can carry many streams at once.
+
+static std::mutex g_curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void curl_share_lock_cb(CURL*, curl_lock_data data,
+                               curl_lock_access, void*) {
+    g_curl_share_locks[data].lock();
+}
+
+static void curl_share_unlock_cb(CURL*, curl_lock_data data, void*) {
+    g_curl_share_locks[data].unlock();
+}
+
+// Function-local static like connection_pool(); lives for the process
+static CURLSH* shared_connection_cache() {
+    static CURLSH* share = []() {
+        CURLSH* s = curl_share_init();
+        curl_share_setopt(s, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        curl_share_setopt(s, CURLSHOPT_LOCKFUNC, curl_share_lock_cb);
+        curl_share_setopt(s, CURLSHOPT_UNLOCKFUNC, curl_share_unlock_cb);
+        return s;
+    }();
+    return share;
+}
+
+// Shared options for every pooled transfer: keep the TCP connection
+// alive between requests instead of paying a handshake each time
+static void set_common_curl_options(CURL* curl, const std::string& url, int timeout_seconds) {
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(timeout_seconds));
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_SHARE, shared_connection_cache());
+
+    // Offer HTTP/2 on every transfer. On our cleartext LAN URLs this
+    // is an "Upgrade: h2c" offer that an HTTP/1.1-only backend (Ollama
+    // today) simply ignores - one header of cost, clean fallback. A
+    // backend that accepts gets its streams multiplexed over one
+    // connection instead of one socket each. PIPEWAIT makes a new
+    // transfer wait to join an existing multiplexable connection
+    // rather than racing it with a fresh TCP handshake.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                     static_cast<long>(CURL_HTTP_VERSION_2_0));
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+}
+
+// Progress callback used purely for cancellation. libcurl invokes it
+// regularly even when no bytes are flowing (i.e. while the backend is
+// still thinking), so an abandoned request tears down the transfer
+// within about a second instead of whenever the next token arrives.
+// Returning non-zero aborts with CURLE_ABORTED_BY_CALLBACK.
+static int curl_cancel_callback(void* userdata, curl_off_t, curl_off_t,
+                                curl_off_t, curl_off_t) {
+    auto* cancelled = static_cast<const std::function<bool()>*>(userdata);
+    return (*cancelled)() ? 1 : 0;
+}
+
+static void set_cancel_callback(CURL* curl, const std::function<bool()>& cancelled) {
+    if (!cancelled) return;
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_cancel_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &cancelled);
+}
+
+// Simple HTTP GET using libcurl - like requests.get() in Python,
+// except the connection is recycled through the pool
 static std::pair<int, std::string> http_get(const std::string& url, int timeout_seconds = 5) {
-    CURL* curl = curl_easy_init();
+    CURL* curl = connection_pool().acquire(url);
     if (!curl) {
         return {500, "{\"error\": \"Failed to initialize HTTP client\"}"};
     }
-    
+
     std::string response_body;
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+
+    set_common_curl_options(curl, url, timeout_seconds);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_body);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(timeout_seconds));
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_reserve_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_body);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);  // Follow redirects
-    
+
     CURLcode res = curl_easy_perform(curl);
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    
-    curl_easy_cleanup(curl);
-    
+
+    connection_pool().release(url, curl, res == CURLE_OK);
+
     if (res != CURLE_OK) {
         return {0, ""};  // Connection failed
     }
-    
+
     return {static_cast<int>(http_code), response_body};
 }
 
 // Simple HTTP POST - like requests.post() in Python
-static std::pair<int, std::string> http_post(const std::string& url, 
+static std::pair<int, std::string> http_post(const std::string& url,
                                                const std::string& body,
-                                               int timeout_seconds = 120) {
-    CURL* curl = curl_easy_init();
+                                               int timeout_seconds = 120,
+                                               const std::function<bool()>& cancelled = nullptr) {
+    CURL* curl = connection_pool().acquire(url);
     if (!curl) {
         return {500, "{\"error\": \"Failed to initialize HTTP client\"}"};
     }
-    
+
     std::string response_body;
-    
+
     // Set headers - equivalent to requests.post(..., headers={...})
     struct curl_slist* headers = nullptr;
     headers = curl_slist_append(headers, "Content-Type: application/json");
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+
+    set_common_curl_options(curl, url, timeout_seconds);
+    set_cancel_callback(curl, cancelled);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_body);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(timeout_seconds));
-    
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_reserve_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_body);
+
     CURLcode res = curl_easy_perform(curl);
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    
+
     curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    
+    connection_pool().release(url, curl, res == CURLE_OK);
+
     if (res != CURLE_OK) {
         return {0, ""};
     }
-    
+
     return {static_cast<int>(http_code), response_body};
 }
 
 // ============================================================================
-// ServiceDiscovery Implementation
+// Streaming forwarding - NDJSON from Ollama in, SSE deltas out
 // ============================================================================
 
-ServiceDiscovery::ServiceDiscovery() : running_(false) {
-    // Initialize CURL globally - do this once per program
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-}
+// Hands chunks from the curl transfer thread to the httplib content
+// provider. Bounded so a slow client applies backpressure to the
+// backend transfer instead of buffering the whole generation in RAM.
+// The producer side is the TransferEngine's single event-loop thread,
+// which must never block - one slow client would stall every live
+// stream - so pushes are non-blocking: a full queue makes the caller
+// pause the transfer (libcurl re-delivers the bytes after resume)
+// rather than wait here.
+class StreamRelay {
+public:
+    enum PushResult { kPushOk, kPushFull, kPushCancelled };
 
-ServiceDiscovery::~ServiceDiscovery() {
-    stop();
-    curl_global_cleanup();
-}
+    // Non-blocking push from the event-loop thread. kPushFull means
+    // nothing was queued and the caller should pause the transfer.
+    PushResult try_push(std::string chunk) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) return kPushCancelled;
+        if (chunks_.size() >= kMaxQueuedChunks) return kPushFull;
+        chunks_.push_back(std::move(chunk));
+        not_empty_.notify_one();
+        return kPushOk;
+    }
 
-void ServiceDiscovery::start() {
-    if (running_.load()) return;
-    
-    running_.store(true);
-    
-    // Spawn background threads
-    // In Python: threading.Thread(target=self.discovery_loop).start()
-    discovery_thread_ = std::thread(&ServiceDiscovery::discovery_loop, this);
-    health_thread_ = std::thread(&ServiceDiscovery::health_check_loop, this);
-    
-    std::cout << "[Discovery] Started ZeroconfAI service discovery" << std::endl;
-}
+    // Push that ignores the capacity bound (but not cancellation),
+    // for the terminal "data: [DONE]" event: once the transfer has
+    // ended there is no pause/resume left to retry through, and
+    // overshooting the bound by one small chunk beats dropping the
+    // terminator the client is waiting on.
+    void push_final(std::string chunk) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) return;
+        chunks_.push_back(std::move(chunk));
+        not_empty_.notify_one();
+    }
 
-void ServiceDiscovery::stop() {
-    if (!running_.load()) return;
-    
-    running_.store(false);
-    
-    // Wait for threads to finish - like thread.join() in Python
-    if (discovery_thread_.joinable()) {
-        discovery_thread_.join();
+    // Returns false when the stream is finished (or cancelled) and
+    // no chunks remain
+    bool pop(std::string& chunk) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] {
+            return !chunks_.empty() || closed_ || cancelled_;
+        });
+        if (chunks_.empty()) return false;
+        chunk = std::move(chunks_.front());
+        chunks_.pop_front();
+        return true;
     }
-    if (health_thread_.joinable()) {
-        health_thread_.join();
+
+    // Producer side is done - lets pop() drain and then return false
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
     }
-    
-    std::cout << "[Discovery] Stopped service discovery" << std::endl;
+
+    // Consumer side gave up - makes the transfer abort on its next
+    // push or cancellation check
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+        not_empty_.notify_all();
+    }
+
+    bool is_cancelled() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cancelled_;
+    }
+
+private:
+    static constexpr size_t kMaxQueuedChunks = 256;
+
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::deque<std::string> chunks_;
+    bool closed_ = false;
+    bool cancelled_ = false;
+};
+
+// Locates the next '\n' 16 bytes at a time. At token rate across a
+// hundred concurrent streams the splitter runs on every curl buffer,
+// so the byte scan is done with SSE2 (NEON on ARM); elsewhere memchr
+// is already close enough.
+static const char* find_newline(const char* data, size_t len) {
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if (mask) {
+            return data + i + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    for (; i < len; i++) {
+        if (data[i] == '\n') return data + i;
+    }
+    return nullptr;
+#elif defined(__ARM_NEON)
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+        if (vmaxvq_u8(vceqq_u8(block, newline))) {
+            for (size_t k = 0; k < 16; k++) {
+                if (data[i + k] == '\n') return data + i + k;
+            }
+        }
+    }
+    for (; i < len; i++) {
+        if (data[i] == '\n') return data + i;
+    }
+    return nullptr;
+#else
+    return static_cast<const char*>(std::memchr(data, '\n', len));
+#endif
 }
 
-void ServiceDiscovery::discovery_loop() {
-    // This is where mDNS discovery happens
-    // For now, we'll implement a simplified version that looks for known services
-    
-    std::cout << "[Discovery] Starting mDNS discovery for _zeroconfai._tcp" << std::endl;
-    
-    while (running_.load()) {
-        // TODO: Replace with actual Avahi/Bonjour browse
-        // For now, let's check for Ollama on localhost as a proof of concept
-        
-        // Check if Ollama is running (common ZeroconfAI-compatible service)
-        auto [status, _] = http_get("http://localhost:11434/api/tags", 2);
-        
-        if (status == 200) {
-            std::lock_guard<std::mutex> lock(services_mutex_);
-            
-            std::string service_name = "ollama-localhost";
-            auto it = services_.find(service_name);
-            
-            if (it == services_.end()) {
-                // New service discovered
-                ServiceInfo info(service_name, "127.0.0.1", 11434, 10);
-                services_[service_name] = info;
-                std::cout << "[Discovery] Found service: " << service_name 
-                         << " at " << info.url << std::endl;
-            } else {
-                // Update last_seen timestamp
-                it->second.last_seen = std::chrono::system_clock::now();
+// Returns a pointer to the first byte of the value for "key": within
+// line (whitespace after the colon skipped), or nullptr
+static const char* find_json_value(const char* line, size_t len, const char* key) {
+    size_t key_len = std::strlen(key);
+    const char* end = line + len;
+
+    const char* hit = static_cast<const char*>(memmem(line, len, key, key_len));
+    if (!hit) return nullptr;
+
+    const char* cursor = hit + key_len;
+    while (cursor < end && std::isspace(static_cast<unsigned char>(*cursor))) cursor++;
+    if (cursor >= end || *cursor != ':') return nullptr;
+    cursor++;
+    while (cursor < end && std::isspace(static_cast<unsigned char>(*cursor))) cursor++;
+    return cursor < end ? cursor : nullptr;
+}
+
+// Incrementally converts Ollama's newline-delimited JSON stream into
+// OpenAI "chat.completion.chunk" SSE events. Ollama chunks arrive at
+// token granularity and can split a JSON line across curl buffers, so
+// a partial trailing line carries over between feed() calls - but
+// complete lines are translated straight out of the curl buffer, no
+// copy and no DOM. Each chunk line is flat and predictable, so the
+// two fields the translation uses (message.content and done) are
+// pulled out with byte scans; the content's escaped bytes are spliced
+// verbatim into the outgoing delta, since both sides are JSON string
+// literals.
+class NdjsonToSse {
+public:
+    NdjsonToSse(StreamRelay& relay, std::string model)
+        : relay_(relay) {
+        // Everything constant across the stream is rendered once
+        json model_json = model;  // Escapes the name, quotes included
+        prefix_ = "data: {\"id\":\"chatcmpl-zeroconfai\","
+                  "\"object\":\"chat.completion.chunk\","
+                  "\"created\":" + std::to_string(std::time(nullptr)) + ","
+                  "\"model\":" + model_json.dump() + ","
+                  "\"choices\":[{\"index\":0,\"delta\":{";
+    }
+
+    // Feed one curl buffer; emits one SSE event per complete line.
+    // Returns a TransferEngine data verdict. kDataPause means the
+    // relay filled mid-buffer: nothing was consumed as far as libcurl
+    // is concerned and it re-delivers the same buffer after resume -
+    // consumed_ remembers how far this converter already got, so no
+    // event goes out twice.
+    int feed(const char* data, size_t len) {
+        // Skip what already went out on the delivery we paused
+        data += consumed_;
+        len -= consumed_;
+
+        // A line completed during a paused delivery waits, whole, in
+        // partial_ - retry it before touching new bytes
+        if (partial_ready_) {
+            int verdict = emit_line(partial_.data(), partial_.size());
+            if (verdict != TransferEngine::kDataContinue) return verdict;
+            partial_ready_ = false;
+            partial_.clear();
+        }
+
+        // Finish the fragment carried over from the previous buffer.
+        // Its bytes are counted consumed before emitting: the full
+        // line survives in partial_, so a pause retries from there.
+        if (!partial_.empty() && len > 0) {
+            const char* newline = find_newline(data, len);
+            if (!newline) {
+                partial_.append(data, len);
+                consumed_ = 0;
+                return TransferEngine::kDataContinue;
             }
+            partial_.append(data, static_cast<size_t>(newline - data));
+            size_t advance = static_cast<size_t>(newline - data) + 1;
+            consumed_ += advance;
+            data += advance;
+            len -= advance;
+            int verdict = emit_line(partial_.data(), partial_.size());
+            if (verdict != TransferEngine::kDataContinue) {
+                partial_ready_ = true;
+                return verdict;
+            }
+            partial_.clear();
         }
-        
-        // Clean up stale services (not seen in 30 seconds)
-        {
-            std::lock_guard<std::mutex> lock(services_mutex_);
-            auto now = std::chrono::system_clock::now();
-            
-            // C++ doesn't let you modify a map while iterating, so collect keys to remove
-            std::vector<std::string> to_remove;
-            
-            for (const auto& [name, service] : services_) {
-                auto age = std::chrono::duration_cast<std::chrono::seconds>(
-                    now - service.last_seen
-                ).count();
-                
-                if (age > 30) {
-                    to_remove.push_back(name);
-                }
+
+        // Complete lines straight out of the buffer; only a trailing
+        // fragment is copied over to the next call
+        while (len > 0) {
+            const char* newline = find_newline(data, len);
+            if (!newline) {
+                partial_.append(data, len);
+                break;
             }
-            
-            for (const auto& name : to_remove) {
-                std::cout << "[Discovery] Removing stale service: " << name << std::endl;
-                services_.erase(name);
+            int verdict = emit_line(data, static_cast<size_t>(newline - data));
+            if (verdict != TransferEngine::kDataContinue) {
+                // consumed_ still points at this line's first byte,
+                // so the resumed delivery re-scans it from the buffer
+                return verdict;
+            }
+            size_t advance = static_cast<size_t>(newline - data) + 1;
+            consumed_ += advance;
+            data += advance;
+            len -= advance;
+        }
+        consumed_ = 0;
+        return TransferEngine::kDataContinue;
+    }
+
+    // Called when the backend transfer ends - flushes any trailing
+    // line and sends the SSE terminator. Best-effort: the transfer is
+    // over, so there is no pause left to retry a full queue through;
+    // a full queue here can drop at most this final delta, while the
+    // terminator goes out unconditionally via push_final().
+    void finish() {
+        if (partial_ready_ || !partial_.empty()) {
+            emit_line(partial_.data(), partial_.size());
+            partial_.clear();
+            partial_ready_ = false;
+        }
+        if (!sent_final_) {
+            relay_.push_final("data: [DONE]\n\n");
+            sent_final_ = true;
+        }
+    }
+
+private:
+    // Translates one NDJSON line into an SSE event and queues it.
+    // Returns a TransferEngine verdict; on kDataPause nothing was
+    // queued, so the very same line can be retried after resume.
+    int emit_line(const char* line, size_t len) {
+        while (len > 0 && (line[len - 1] == '\r')) len--;
+        if (len == 0) return TransferEngine::kDataContinue;
+
+        // Tolerate the occasional garbage line rather than killing
+        // the whole stream
+        if (line[0] != '{') return TransferEngine::kDataContinue;
+
+        // message.content: "content" only ever appears inside the
+        // message object, so one scan finds it. The value's escaped
+        // bytes go out verbatim.
+        const char* content = nullptr;
+        size_t content_len = 0;
+        if (const char* value = find_json_value(line, len, "\"content\"")) {
+            const char* end = line + len;
+            if (value < end && *value == '"') {
+                const char* cursor = value + 1;
+                while (cursor < end && *cursor != '"') {
+                    cursor += (*cursor == '\\') ? 2 : 1;
+                }
+                if (cursor < end) {
+                    content = value + 1;
+                    content_len = static_cast<size_t>(cursor - content);
+                }
             }
         }
-        
-        // Sleep for 5 seconds between discovery attempts
-        std::this_thread::sleep_for(std::chrono::seconds(5));
+
+        bool done = false;
+        if (const char* value = find_json_value(line, len, "\"done\"")) {
+            done = (*value == 't');
+        }
+
+        std::string event;
+        event.reserve(prefix_.size() + content_len + 64);
+        event += prefix_;
+        if (content_len > 0) {
+            event += "\"content\":\"";
+            event.append(content, content_len);
+            event += '"';
+        }
+        event += "},\"finish_reason\":";
+        event += done ? "\"stop\"" : "null";
+        event += "}]}\n\n";
+
+        switch (relay_.try_push(std::move(event))) {
+            case StreamRelay::kPushFull:
+                return TransferEngine::kDataPause;
+            case StreamRelay::kPushCancelled:
+                return TransferEngine::kDataAbort;
+            case StreamRelay::kPushOk:
+                break;
+        }
+
+        if (done && !sent_final_) {
+            // The terminator rides along with the final delta even if
+            // it momentarily overshoots the queue bound - see
+            // push_final()
+            relay_.push_final("data: [DONE]\n\n");
+            sent_final_ = true;
+        }
+        return TransferEngine::kDataContinue;
+    }
+
+    StreamRelay& relay_;
+    std::string prefix_;
+    std::string partial_;
+    // Pause/resume bookkeeping: bytes of the current curl buffer
+    // already handled, and whether partial_ holds a complete line
+    // whose emit was paused
+    size_t consumed_ = 0;
+    bool partial_ready_ = false;
+    bool sent_final_ = false;
+};
+
+// ============================================================================
+// TransferEngine Implementation
+// ============================================================================
+
+struct TransferEngine::Transfer {
+    std::string url;
+    std::string body;
+    int timeout_seconds = 120;
+    DataFn on_data;
+    DoneFn on_done;
+    CancelFn cancelled;
+
+    CURL* handle = nullptr;
+    struct curl_slist* headers = nullptr;
+    bool paused = false;
+};
+
+// Write callback on the event-loop thread - hands bytes to the
+// transfer's sink. Returning 0 aborts the transfer, which is exactly
+// what we want when the client disconnected.
+static size_t curl_engine_write_callback(void* contents, size_t size, size_t nmemb,
+                                         void* userdata) {
+    size_t total_size = size * nmemb;
+    auto* transfer = static_cast<TransferEngine::Transfer*>(userdata);
+
+    switch (transfer->on_data(static_cast<char*>(contents), total_size)) {
+        case TransferEngine::kDataContinue:
+            return total_size;
+        case TransferEngine::kDataPause:
+            // Nothing consumed; libcurl re-delivers after resume
+            transfer->paused = true;
+            return CURL_WRITEFUNC_PAUSE;
+        default:
+            return 0;  // Abort
+    }
+}
+
+// The write callback only notices a cancelled client when the next
+// chunk arrives, which for a slow generation can be seconds away. The
+// progress callback fires regardless, so the backend stops burning
+// GPU time on an abandoned stream almost immediately.
+static int curl_engine_cancel_callback(void* userdata, curl_off_t, curl_off_t,
+                                       curl_off_t, curl_off_t) {
+    auto* transfer = static_cast<TransferEngine::Transfer*>(userdata);
+    return (transfer->cancelled && transfer->cancelled()) ? 1 : 0;
+}
+
+TransferEngine& TransferEngine::instance() {
+    static TransferEngine engine;
+    return engine;
+}
+
+void TransferEngine::start() {
+    if (running_.exchange(true)) return;
+    multi_ = curl_multi_init();
+    // Let concurrent streaming generations share one HTTP/2 connection
+    // per backend (when the backend negotiates it) instead of holding
+    // a TCP connection each
+    curl_multi_setopt(static_cast<CURLM*>(multi_), CURLMOPT_PIPELINING,
+                      CURLPIPE_MULTIPLEX);
+    loop_thread_ = std::thread(&TransferEngine::event_loop, this);
+}
+
+void TransferEngine::stop() {
+    if (!running_.exchange(false)) return;
+    curl_multi_wakeup(static_cast<CURLM*>(multi_));
+    if (loop_thread_.joinable()) {
+        loop_thread_.join();
+    }
+    curl_multi_cleanup(static_cast<CURLM*>(multi_));
+    multi_ = nullptr;
+}
+
+void TransferEngine::submit_post(const std::string& url, std::string body,
+                                 int timeout_seconds, DataFn on_data,
+                                 DoneFn on_done, CancelFn cancelled) {
+    auto* transfer = new Transfer;
+    transfer->url = url;
+    transfer->body = std::move(body);
+    transfer->timeout_seconds = timeout_seconds;
+    transfer->on_data = std::move(on_data);
+    transfer->on_done = std::move(on_done);
+    transfer->cancelled = std::move(cancelled);
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_.push_back(transfer);
+    }
+    // Kick the loop out of curl_multi_poll() so the transfer starts
+    // now, not at the next poll timeout
+    curl_multi_wakeup(static_cast<CURLM*>(multi_));
+}
+
+void TransferEngine::event_loop() {
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    std::map<CURL*, Transfer*> active;
+
+    // Finish one transfer: hand the connection back (only reusable
+    // after a clean end-of-response) and fire the completion callback
+    auto finish = [&](Transfer* transfer, CURLcode result) {
+        long http_code = 0;
+        curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &http_code);
+
+        curl_multi_remove_handle(multi, transfer->handle);
+        curl_slist_free_all(transfer->headers);
+        connection_pool().release(transfer->url, transfer->handle,
+                                  result == CURLE_OK);
+
+        active.erase(transfer->handle);
+        transfer->on_done(result == CURLE_OK, http_code);
+        delete transfer;
+    };
+
+    while (running_.load()) {
+        // Adopt newly submitted transfers. Handles are configured here
+        // on the loop thread, so one thread owns every easy handle for
+        // its whole life - no cross-thread handle use.
+        std::vector<Transfer*> fresh;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            fresh.swap(pending_);
+        }
+        for (auto* transfer : fresh) {
+            transfer->handle = connection_pool().acquire(transfer->url);
+            if (!transfer->handle) {
+                transfer->on_done(false, 0);
+                delete transfer;
+                continue;
+            }
+            transfer->headers =
+                curl_slist_append(nullptr, "Content-Type: application/json");
+
+            set_common_curl_options(transfer->handle, transfer->url,
+                                    transfer->timeout_seconds);
+            curl_easy_setopt(transfer->handle, CURLOPT_POSTFIELDS,
+                             transfer->body.c_str());
+            curl_easy_setopt(transfer->handle, CURLOPT_HTTPHEADER, transfer->headers);
+            curl_easy_setopt(transfer->handle, CURLOPT_WRITEFUNCTION,
+                             curl_engine_write_callback);
+            curl_easy_setopt(transfer->handle, CURLOPT_WRITEDATA, transfer);
+            curl_easy_setopt(transfer->handle, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(transfer->handle, CURLOPT_XFERINFOFUNCTION,
+                             curl_engine_cancel_callback);
+            curl_easy_setopt(transfer->handle, CURLOPT_XFERINFODATA, transfer);
+
+            curl_multi_add_handle(multi, transfer->handle);
+            active.emplace(transfer->handle, transfer);
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        int msgs_left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &msgs_left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            finish(active.at(msg->easy_handle), msg->data.result);
+        }
+
+        // Poke paused transfers; the write callback just re-pauses if
+        // the downstream side is still full, so this is cheap
+        for (auto& [handle, transfer] : active) {
+            if (transfer->paused) {
+                transfer->paused = false;
+                curl_easy_pause(handle, CURLPAUSE_CONT);
+            }
+        }
+
+        // Sleep until a socket is ready, a timeout fires, or
+        // submit_post()/stop() wakes us
+        curl_multi_poll(multi, nullptr, 0, 200, nullptr);
+    }
+
+    // Shutdown: abort whatever is still in flight so on_done always
+    // fires and in-flight accounting unwinds
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (auto* transfer : pending_) {
+            transfer->on_done(false, 0);
+            delete transfer;
+        }
+        pending_.clear();
+    }
+    while (!active.empty()) {
+        finish(active.begin()->second, CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+// Cheap scan for the top-level "model" string value - routing needs
+// it before (and without) building a DOM. Model names contain no
+// escape sequences, so a plain quote scan is enough.
+static std::string extract_model_field(const std::string& body) {
+    auto pos = body.find("\"model\"");
+    if (pos == std::string::npos) return "";
+    pos = body.find(':', pos + 7);
+    if (pos == std::string::npos) return "";
+    pos = body.find('"', pos + 1);
+    if (pos == std::string::npos) return "";
+    auto end = body.find('"', pos + 1);
+    if (end == std::string::npos) return "";
+    return body.substr(pos + 1, end - pos - 1);
+}
+
+// Maps the OpenAI sampling parameters onto Ollama's options object.
+// Dropping them would make the backend generate at its own defaults
+// (temperature 0.8, notably) - wrong for any request that set them,
+// and fatal for the completion cache, which keys on temperature 0 and
+// would replay a sampled response as deterministic. Templated so the
+// arena-backed json works too.
+template <typename Json>
+static Json translate_sampling_options(const Json& request) {
+    Json options = Json::object();
+    if (request.contains("temperature")) options["temperature"] = request["temperature"];
+    if (request.contains("top_p")) options["top_p"] = request["top_p"];
+    if (request.contains("seed")) options["seed"] = request["seed"];
+    if (request.contains("stop")) options["stop"] = request["stop"];
+    if (request.contains("max_tokens")) options["num_predict"] = request["max_tokens"];
+    if (request.contains("presence_penalty")) {
+        options["presence_penalty"] = request["presence_penalty"];
+    }
+    if (request.contains("frequency_penalty")) {
+        options["frequency_penalty"] = request["frequency_penalty"];
+    }
+    return options;
+}
+
+// Cheap scan for "stream": true without building a DOM - the fast
+// path must know whether to stream before deciding how to forward
+static bool body_requests_stream(const std::string& body) {
+    auto pos = body.find("\"stream\"");
+    if (pos == std::string::npos) return false;
+    pos = body.find(':', pos + 8);
+    if (pos == std::string::npos) return false;
+    pos = body.find_first_not_of(" \t\r\n", pos + 1);
+    return pos != std::string::npos && body.compare(pos, 4, "true") == 0;
+}
+
+// ============================================================================
+// Private runtime state - per-user paths for cross-process files
+// ============================================================================
+// The prober lock, shared table segment and warm-start cache used to
+// live at fixed world-writable /tmp and shm names. On a shared host
+// another local user could pre-create and own them, inject backend
+// records, and have the proxy forward chat completions (prompts
+// included) to an address of their choosing - or win the prober
+// election and feed every reader instance. State now lives under
+// $XDG_RUNTIME_DIR (per-user 0700 tmpfs on systemd hosts), or a
+// per-UID /tmp directory elsewhere; files are 0600 and nothing is
+// trusted unless this user owns it.
+
+// Returns this user's runtime state directory, creating it 0700 if
+// needed. Empty when no safe location could be secured - callers
+// disable the feature rather than fall back to a shared path.
+static std::string runtime_state_dir() {
+    const char* xdg = std::getenv("XDG_RUNTIME_DIR");
+    std::string dir = (xdg && *xdg)
+        ? std::string(xdg) + "/zeroconfai"
+        : "/tmp/zeroconfai-" + std::to_string(::getuid());
+
+    if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return "";
+    }
+    // Never trust a directory someone else set up (or a symlink
+    // planted where ours should be)
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != ::getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        log_warn("Discovery", "Runtime state dir " + dir +
+                 " is not a private directory we own; ignoring it");
+        return "";
+    }
+    return dir;
+}
+
+// open(O_CREAT, 0600) that only returns an fd for a regular file this
+// user owns; anything else is someone else's file wearing our name
+static int open_private_state_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_NOFOLLOW, 0600);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != ::getuid()) {
+        log_warn("Discovery", "State file " + path +
+                 " is not a regular file we own; ignoring it");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ============================================================================
+// SharedServiceTable Implementation
+// ============================================================================
+
+// Per-UID segment name; the uid suffix keeps users on a shared host
+// out of each other's tables
+static std::string shared_table_name() {
+    return "/zeroconfai-services-" + std::to_string(::getuid());
+}
+
+// Fixed-size wire format so the segment layout is the same in every
+// process. Strings are truncated to fit; mDNS names and IP literals
+// are comfortably inside these bounds. The magic doubles as a format
+// version - bump it whenever Record changes, so an old-format segment
+// reads as garbage-to-reinitialize instead of misaligned records.
+struct SharedServiceTable::Layout {
+    static constexpr uint32_t kMagic = 0x5A434131u;  // "ZCA1"
+
+    struct Record {
+        static constexpr uint32_t kMaxModels = 8;
+
+        char name[64];
+        char address[46];      // Fits an IPv6 literal
+        int32_t port;
+        int32_t priority;
+        uint8_t is_healthy;
+        uint8_t openai_native;
+        // Routing metadata the prober learned: without these, reader
+        // instances would silently lose model-aware routing and the
+        // TXT-declared admission cap
+        int32_t max_concurrent;
+        uint32_t model_count;
+        char models[kMaxModels][64];  // Resident models, truncated to fit
+    };
+
+    uint32_t magic;
+    std::atomic<uint32_t> sequence;  // Seqlock: odd while a write is in progress
+    uint32_t count;
+    Record records[kMaxServices];
+};
+
+bool SharedServiceTable::attach() {
+    std::string state_dir = runtime_state_dir();
+    if (state_dir.empty()) {
+        log_warn("Discovery", "No private runtime dir; shared table disabled");
+        return false;
+    }
+
+    // Owner election: whoever holds the flock is this host's prober
+    // (for this user). The lock dies with the process, so a crashed
+    // prober is replaced by the next instance that attaches.
+    lock_fd_ = open_private_state_file(state_dir + "/prober.lock");
+    owner_ = (lock_fd_ >= 0) && (::flock(lock_fd_, LOCK_EX | LOCK_NB) == 0);
+
+    shm_fd_ = ::shm_open(shared_table_name().c_str(), O_CREAT | O_RDWR, 0600);
+    if (shm_fd_ < 0) {
+        log_warn("Discovery", "shm_open failed; shared table disabled");
+        return false;
+    }
+    // Routing decisions come out of this segment - never trust one
+    // someone else owns
+    struct stat st;
+    if (::fstat(shm_fd_, &st) != 0 || st.st_uid != ::getuid()) {
+        log_warn("Discovery",
+                 "Shared table segment is not ours; shared table disabled");
+        ::close(shm_fd_);
+        shm_fd_ = -1;
+        return false;
+    }
+    if (::ftruncate(shm_fd_, sizeof(Layout)) != 0) {
+        ::close(shm_fd_);
+        shm_fd_ = -1;
+        return false;
+    }
+
+    void* mapped = ::mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, shm_fd_, 0);
+    if (mapped == MAP_FAILED) {
+        ::close(shm_fd_);
+        shm_fd_ = -1;
+        return false;
+    }
+    layout_ = static_cast<Layout*>(mapped);
+
+    if (owner_ && layout_->magic != Layout::kMagic) {
+        // Fresh segment - initialize it before readers trust it
+        layout_->sequence.store(0, std::memory_order_relaxed);
+        layout_->count = 0;
+        layout_->magic = Layout::kMagic;
+    }
+
+    log_info("Discovery", std::string("Shared service table attached as ") +
+             (owner_ ? "prober" : "reader"));
+    return true;
+}
+
+void SharedServiceTable::write_services(const std::vector<ServiceInfo>& services) {
+    if (!layout_ || !owner_) return;
+
+    // Seqlock write: odd sequence tells readers a write is in flight
+    layout_->sequence.fetch_add(1, std::memory_order_acq_rel);
+
+    uint32_t count = static_cast<uint32_t>(
+        std::min(services.size(), kMaxServices));
+    layout_->count = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        Layout::Record& record = layout_->records[i];
+        std::memset(&record, 0, sizeof(record));
+        std::strncpy(record.name, services[i].name.c_str(), sizeof(record.name) - 1);
+        std::strncpy(record.address, services[i].address.c_str(), sizeof(record.address) - 1);
+        record.port = services[i].port;
+        record.priority = services[i].priority;
+        record.is_healthy = services[i].is_healthy ? 1 : 0;
+        record.openai_native = services[i].openai_native ? 1 : 0;
+        record.max_concurrent = services[i].max_concurrent;
+
+        uint32_t model_count = 0;
+        for (const auto& model : services[i].models) {
+            if (model_count >= Layout::Record::kMaxModels) break;
+            std::strncpy(record.models[model_count], model.c_str(),
+                         sizeof(record.models[model_count]) - 1);
+            model_count++;
+        }
+        record.model_count = model_count;
+    }
+
+    layout_->sequence.fetch_add(1, std::memory_order_release);
+}
+
+bool SharedServiceTable::read_services(std::vector<ServiceInfo>& out) const {
+    if (!layout_ || layout_->magic != Layout::kMagic) return false;
+
+    // Seqlock read: retry until we get a copy whose sequence did not
+    // change (and was even) while we were copying
+    for (int attempt = 0; attempt < 16; attempt++) {
+        uint32_t seq_before = layout_->sequence.load(std::memory_order_acquire);
+        if (seq_before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        uint32_t count = layout_->count;
+        if (count > kMaxServices) continue;  // Torn read, retry
+
+        Layout::Record copies[kMaxServices];
+        std::memcpy(copies, layout_->records, count * sizeof(Layout::Record));
+
+        uint32_t seq_after = layout_->sequence.load(std::memory_order_acquire);
+        if (seq_before != seq_after) continue;
+
+        out.clear();
+        out.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            // Defensive termination in case of a writer from a future
+            // version with longer fields
+            copies[i].name[sizeof(copies[i].name) - 1] = '\0';
+            copies[i].address[sizeof(copies[i].address) - 1] = '\0';
+
+            ServiceInfo info(copies[i].name, copies[i].address,
+                             copies[i].port, copies[i].priority);
+            info.is_healthy = copies[i].is_healthy != 0;
+            info.openai_native = copies[i].openai_native != 0;
+            info.max_concurrent = copies[i].max_concurrent;
+
+            uint32_t model_count = std::min(copies[i].model_count,
+                                            Layout::Record::kMaxModels);
+            for (uint32_t m = 0; m < model_count; m++) {
+                copies[i].models[m][sizeof(copies[i].models[m]) - 1] = '\0';
+                info.models.insert(copies[i].models[m]);
+            }
+            out.push_back(std::move(info));
+        }
+        return true;
+    }
+    return false;
+}
+
+SharedServiceTable::~SharedServiceTable() {
+    if (layout_) {
+        ::munmap(layout_, sizeof(Layout));
+    }
+    if (shm_fd_ >= 0) {
+        ::close(shm_fd_);
+    }
+    if (lock_fd_ >= 0) {
+        // Closing drops the flock, letting another instance take over
+        ::close(lock_fd_);
+    }
+}
+
+// ============================================================================
+// ServiceDiscovery Implementation
+// ============================================================================
+
+ServiceDiscovery::ServiceDiscovery(bool use_shared_table)
+    : use_shared_table_(use_shared_table), running_(false) {
+    // Initialize CURL globally - do this once per program
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // Start with a valid (empty) snapshot so readers never see null
+    snapshot_ = std::make_shared<const std::vector<ServiceInfo>>();
+}
+
+// ============================================================================
+// Warm-start cache - last known service table in a memory-mapped file
+// ============================================================================
+// After a restart the proxy used to answer 503 until the first
+// discovery cycle and health pass completed - several seconds of
+// failures after every deploy. The last published table is mirrored
+// into a small mmap'd file on change; startup loads it instantly,
+// serves those backends optimistically with their last known health
+// state, and lets live discovery and the health loop confirm or
+// evict them.
+
+// Same fixed-size record idea as the shared table, but file-backed
+// and single-writer; the two formats can evolve independently
+struct WarmStartLayout {
+    static constexpr uint32_t kMagic = 0x5A435753u;  // "ZCWS"
+    static constexpr size_t kMaxRecords = 64;
+
+    struct Record {
+        char name[64];
+        char address[46];
+        int32_t port;
+        int32_t priority;
+        uint8_t is_healthy;
+        uint8_t openai_native;
+    };
+
+    uint32_t magic;
+    uint32_t count;
+    Record records[kMaxRecords];
+};
+
+void ServiceDiscovery::load_warm_start() {
+    // Restored records become routing targets, so the cache lives in
+    // the private per-user state dir and is only trusted if we own it
+    std::string state_dir = runtime_state_dir();
+    if (state_dir.empty()) return;
+
+    int fd = open_private_state_file(state_dir + "/warmstart.tbl");
+    if (fd < 0) return;
+    if (::ftruncate(fd, sizeof(WarmStartLayout)) != 0) {
+        ::close(fd);
+        return;
+    }
+
+    void* mapped = ::mmap(nullptr, sizeof(WarmStartLayout),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);  // The mapping survives the close
+    if (mapped == MAP_FAILED) return;
+    warm_start_map_ = mapped;
+
+    auto* layout = static_cast<WarmStartLayout*>(mapped);
+    if (layout->magic != WarmStartLayout::kMagic) {
+        // First run (or an older format): start from an empty table
+        layout->count = 0;
+        layout->magic = WarmStartLayout::kMagic;
+        return;
+    }
+
+    uint32_t count = std::min<uint32_t>(layout->count, WarmStartLayout::kMaxRecords);
+
+    std::lock_guard<std::mutex> lock(services_mutex_);
+    for (uint32_t i = 0; i < count; i++) {
+        WarmStartLayout::Record& record = layout->records[i];
+        record.name[sizeof(record.name) - 1] = '\0';
+        record.address[sizeof(record.address) - 1] = '\0';
+
+        ServiceInfo info(record.name, record.address, record.port, record.priority);
+        // Optimistic: serve it as last seen. A backend that died while
+        // we were down costs one failed forward, which beats every
+        // client getting 503 for the whole first discovery pass.
+        info.is_healthy = record.is_healthy != 0;
+        info.openai_native = record.openai_native != 0;
+        services_.emplace(info.name, std::move(info));
+    }
+
+    if (count > 0) {
+        log_info("Discovery", "Warm start: restored " + std::to_string(count) +
+                 " service(s) from the last run");
+        publish_snapshot();
+    }
+}
+
+void ServiceDiscovery::save_warm_start() {
+    // Caller holds services_mutex_. Plain stores into the mapping -
+    // the kernel writes dirty pages back on its own schedule, which
+    // is plenty for an advisory cache.
+    if (!warm_start_map_) return;
+    auto* layout = static_cast<WarmStartLayout*>(warm_start_map_);
+
+    uint32_t count = 0;
+    for (const auto& [name, service] : services_) {
+        if (count >= WarmStartLayout::kMaxRecords) break;
+        WarmStartLayout::Record& record = layout->records[count];
+        std::memset(&record, 0, sizeof(record));
+        std::strncpy(record.name, service.name.c_str(), sizeof(record.name) - 1);
+        std::strncpy(record.address, service.address.c_str(), sizeof(record.address) - 1);
+        record.port = service.port;
+        record.priority = service.priority;
+        record.is_healthy = service.is_healthy ? 1 : 0;
+        record.openai_native = service.openai_native ? 1 : 0;
+        count++;
+    }
+    layout->count = count;
+}
+
+void ServiceDiscovery::publish_snapshot() {
+    // Caller holds services_mutex_. Build the healthy, priority-sorted
+    // view once here so the request path never has to.
+
+    // As this host's prober, mirror the full table (unhealthy entries
+    // included) into shared memory for the reader instances
+    if (use_shared_table_ && shared_table_.is_owner()) {
+        std::vector<ServiceInfo> all;
+        all.reserve(services_.size());
+        for (const auto& [name, service] : services_) {
+            all.push_back(service);
+        }
+        shared_table_.write_services(all);
+    }
+
+    // Mirror to the warm-start file too, so the next restart begins
+    // with this table instead of an empty one. Only the table owner
+    // writes it: in shared-table mode every reader republishes every
+    // 500 ms, and concurrent plain-store writers could tear a record
+    // (one service's name next to another's address) that the next
+    // start would serve optimistically.
+    if (!use_shared_table_ || shared_table_.is_owner()) {
+        save_warm_start();
+    }
+
+    auto fresh = std::make_shared<std::vector<ServiceInfo>>();
+    fresh->reserve(services_.size());
+
+    for (const auto& [name, service] : services_) {
+        if (service.is_healthy) {
+            fresh->push_back(service);
+        }
+    }
+    std::sort(fresh->begin(), fresh->end());
+
+    // Atomically swap the published pointer. In-flight readers keep
+    // their old snapshot alive via the shared_ptr refcount.
+    std::atomic_store_explicit(&snapshot_,
+                               ServiceSnapshot(std::move(fresh)),
+                               std::memory_order_release);
+}
+
+ServiceDiscovery::~ServiceDiscovery() {
+    if (warm_start_map_) {
+        ::munmap(warm_start_map_, sizeof(WarmStartLayout));
+        warm_start_map_ = nullptr;
+    }
+    stop();
+    curl_global_cleanup();
+}
+
+void ServiceDiscovery::start() {
+    // Reload the last run's table before any thread starts - a warm
+    // restart can route its first request in milliseconds instead of
+    // 503ing until the first full discovery pass
+    load_warm_start();
+
+    if (running_.load()) return;
+    
+    running_.store(true);
+
+    if (use_shared_table_ && shared_table_.attach() && !shared_table_.is_owner()) {
+        // Another instance on this host is already probing the fleet -
+        // just mirror its table and spawn no probe threads at all
+        discovery_thread_ = std::thread(&ServiceDiscovery::shared_reader_loop, this);
+        log_info("Discovery", "Started as shared-table reader");
+        return;
+    }
+    
+    // Spawn background threads
+    // In Python: threading.Thread(target=self.discovery_loop).start()
+    discovery_thread_ = std::thread(&ServiceDiscovery::discovery_loop, this);
+    health_thread_ = std::thread(&ServiceDiscovery::health_check_loop, this);
+    
+    log_info("Discovery", "Started ZeroconfAI service discovery");
+}
+
+void ServiceDiscovery::shared_reader_loop() {
+    while (running_.load()) {
+        std::vector<ServiceInfo> services;
+        if (shared_table_.read_services(services)) {
+            std::lock_guard<std::mutex> lock(services_mutex_);
+            services_.clear();
+            for (auto& service : services) {
+                services_.emplace(service.name, std::move(service));
+            }
+            publish_snapshot();
+        }
+
+        // The prober refreshes health every few seconds; mirroring at
+        // 500 ms keeps readers well inside one health cycle behind
+        for (int i = 0; i < 5 && running_.load(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+void ServiceDiscovery::stop() {
+    if (!running_.load()) return;
+    
+    running_.store(false);
+    
+    // Wait for threads to finish - like thread.join() in Python
+    if (discovery_thread_.joinable()) {
+        discovery_thread_.join();
+    }
+    if (health_thread_.joinable()) {
+        health_thread_.join();
+    }
+    
+    log_info("Discovery", "Stopped service discovery");
+}
+
+void ServiceDiscovery::add_or_update_service(const ServiceInfo& info) {
+    std::lock_guard<std::mutex> lock(services_mutex_);
+
+    auto it = services_.find(info.name);
+    if (it == services_.end()) {
+        services_.emplace(info.name, info);
+        log_info("Discovery", "Found service: " + info.name + " at " + info.url);
+        publish_snapshot();
+    } else {
+        // Re-announced (possibly with a new address/port after a
+        // restart) - refresh everything except health state
+        it->second.address = info.address;
+        it->second.port = info.port;
+        it->second.url = info.url;
+        it->second.priority = info.priority;
+        it->second.max_concurrent = info.max_concurrent;
+        it->second.last_seen = std::chrono::system_clock::now();
+        // TXT-advertised models only seed an empty entry; a probe's
+        // inventory is authoritative once one has run
+        if (it->second.models.empty() && !info.models.empty()) {
+            it->second.models = info.models;
+        }
+        publish_snapshot();
+    }
+}
+
+void ServiceDiscovery::remove_service(const std::string& name) {
+    std::lock_guard<std::mutex> lock(services_mutex_);
+
+    if (services_.erase(name) > 0) {
+        log_info("Discovery", "Service left the network: " + name);
+        publish_snapshot();
+    }
+}
+
+#ifndef __APPLE__
+
+// ============================================================================
+// AvahiDiscovery - event-driven _zeroconfai._tcp browse (Linux)
+// ============================================================================
+// Avahi drives everything through callbacks on its own poll loop, so a
+// new service shows up in services_ milliseconds after it announces -
+// no polling interval, no wasted HTTP probes. The struct just bundles
+// the loop state so the C callbacks can reach the owning discovery.
+struct AvahiDiscovery {
+    ServiceDiscovery* owner = nullptr;
+    AvahiSimplePoll* poll = nullptr;
+    AvahiClient* client = nullptr;
+
+    static void client_callback(AvahiClient* c, AvahiClientState state, void* userdata) {
+        auto* self = static_cast<AvahiDiscovery*>(userdata);
+        if (state == AVAHI_CLIENT_FAILURE) {
+            log_warn("Discovery", std::string("Avahi client failure: ") +
+                     avahi_strerror(avahi_client_errno(c)));
+            avahi_simple_poll_quit(self->poll);
+        }
+    }
+
+    // TXT records let operators declare capacity at announce time
+    // instead of the proxy discovering it the slow way through probes
+    // and timeouts:
+    //   priority=<n>        lower wins (mDNS convention)
+    //   max_concurrent=<n>  concurrent-request bound for this backend
+    //   models=a,b,c        models expected to be resident
+    // All optional; health probes refresh the model list afterwards.
+    static void apply_txt_records(ServiceInfo& info, AvahiStringList* txt) {
+        for (AvahiStringList* entry = txt; entry;
+             entry = avahi_string_list_get_next(entry)) {
+            char* key = nullptr;
+            char* value = nullptr;
+            size_t value_size = 0;
+            if (avahi_string_list_get_pair(entry, &key, &value, &value_size) < 0 ||
+                !key) {
+                continue;
+            }
+
+            if (value) {
+                if (std::strcmp(key, "priority") == 0) {
+                    info.priority = std::atoi(value);
+                } else if (std::strcmp(key, "max_concurrent") == 0) {
+                    info.max_concurrent = std::atoi(value);
+                } else if (std::strcmp(key, "models") == 0) {
+                    // Comma-separated model names
+                    std::string list(value, value_size);
+                    size_t start = 0;
+                    while (start <= list.size()) {
+                        size_t comma = list.find(',', start);
+                        if (comma == std::string::npos) comma = list.size();
+                        if (comma > start) {
+                            info.models.insert(list.substr(start, comma - start));
+                        }
+                        start = comma + 1;
+                    }
+                }
+            }
+            avahi_free(key);
+            avahi_free(value);
+        }
+    }
+
+    static void resolve_callback(AvahiServiceResolver* resolver,
+                                 AvahiIfIndex /*interface*/, AvahiProtocol /*protocol*/,
+                                 AvahiResolverEvent event,
+                                 const char* name, const char* /*type*/, const char* /*domain*/,
+                                 const char* /*host_name*/, const AvahiAddress* address,
+                                 uint16_t port, AvahiStringList* txt,
+                                 AvahiLookupResultFlags /*flags*/, void* userdata) {
+        auto* self = static_cast<AvahiDiscovery*>(userdata);
+
+        if (event == AVAHI_RESOLVER_FOUND && address && name) {
+            char addr[AVAHI_ADDRESS_STR_MAX];
+            avahi_address_snprint(addr, sizeof(addr), address);
+            ServiceInfo info(name, addr, port);
+            apply_txt_records(info, txt);
+            self->owner->add_or_update_service(info);
+        }
+
+        // One-shot resolve: every resolver frees itself here
+        avahi_service_resolver_free(resolver);
+    }
+
+    static void browse_callback(AvahiServiceBrowser* /*browser*/,
+                                AvahiIfIndex interface, AvahiProtocol protocol,
+                                AvahiBrowserEvent event,
+                                const char* name, const char* type, const char* domain,
+                                AvahiLookupResultFlags /*flags*/, void* userdata) {
+        auto* self = static_cast<AvahiDiscovery*>(userdata);
+
+        switch (event) {
+            case AVAHI_BROWSER_NEW:
+                // The browse only gives us a name; resolve it to an
+                // address and port before it can join the table
+                if (!avahi_service_resolver_new(self->client, interface, protocol,
+                                                name, type, domain, AVAHI_PROTO_INET,
+                                                static_cast<AvahiLookupFlags>(0),
+                                                resolve_callback, self)) {
+                    log_warn("Discovery", std::string("Failed to resolve ") + (name ? name : "?") +
+                             ": " + avahi_strerror(avahi_client_errno(self->client)));
+                }
+                break;
+
+            case AVAHI_BROWSER_REMOVE:
+                // Goodbye packet - drop the service immediately instead
+                // of waiting for health checks to notice
+                if (name) {
+                    self->owner->remove_service(name);
+                }
+                break;
+
+            case AVAHI_BROWSER_FAILURE:
+                log_warn("Discovery", std::string("Avahi browse failure: ") +
+                         avahi_strerror(avahi_client_errno(self->client)));
+                avahi_simple_poll_quit(self->poll);
+                break;
+
+            default:
+                // CACHE_EXHAUSTED / ALL_FOR_NOW are informational
+                break;
+        }
+    }
+
+    // How one browse attempt ended - discovery_loop decides whether
+    // to reconnect, fall back to polling, or just stop
+    enum RunResult {
+        kRunStopped,   // stop() was requested; browse ended cleanly
+        kRunNoDaemon,  // no Avahi daemon to talk to at all
+        kRunFailed     // daemon died or browse failed mid-run
+    };
+
+    // Runs one browse until stop() is requested or Avahi fails
+    int run() {
+        poll = avahi_simple_poll_new();
+        if (!poll) return kRunNoDaemon;
+
+        int error = 0;
+        client = avahi_client_new(avahi_simple_poll_get(poll),
+                                  static_cast<AvahiClientFlags>(0),
+                                  client_callback, this, &error);
+        if (!client) {
+            log_warn("Discovery", std::string("Could not connect to Avahi daemon: ") +
+                     avahi_strerror(error));
+            avahi_simple_poll_free(poll);
+            poll = nullptr;
+            return kRunNoDaemon;
+        }
+
+        AvahiServiceBrowser* browser = avahi_service_browser_new(
+            client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+            "_zeroconfai._tcp", nullptr,
+            static_cast<AvahiLookupFlags>(0), browse_callback, this);
+        if (!browser) {
+            log_warn("Discovery", std::string("Failed to start mDNS browse: ") +
+                     avahi_strerror(avahi_client_errno(client)));
+            avahi_client_free(client);
+            avahi_simple_poll_free(poll);
+            client = nullptr;
+            poll = nullptr;
+            return kRunFailed;
+        }
+
+        log_info("Discovery", "Browsing _zeroconfai._tcp via Avahi");
+
+        // Iterate with a short timeout so stop() is noticed promptly;
+        // a non-zero return means quit was requested or Avahi died
+        while (owner->running_.load()) {
+            if (avahi_simple_poll_iterate(poll, 100) != 0) {
+                break;
+            }
+        }
+
+        avahi_service_browser_free(browser);
+        avahi_client_free(client);
+        avahi_simple_poll_free(poll);
+        client = nullptr;
+        poll = nullptr;
+
+        // If we're still supposed to be running, the poll quit came
+        // from a client or browser failure, not from stop()
+        return owner->running_.load() ? kRunFailed : kRunStopped;
+    }
+};
+
+#endif // !__APPLE__
+
+void ServiceDiscovery::discovery_loop() {
+    log_info("Discovery", "Starting mDNS discovery for _zeroconfai._tcp");
+
+#ifndef __APPLE__
+    // An Avahi daemon restart (crash, package upgrade) kills the
+    // client and quits the browse mid-run. That's transient, so
+    // reconnect and browse again - the standard Avahi recovery
+    // pattern - instead of leaving discovery dead for the rest of the
+    // process while health checks keep the stale table looking alive.
+    // Only a host with no daemon at all, or one that won't stay up,
+    // falls back to localhost polling.
+    constexpr int kMaxConsecutiveFailures = 5;
+    int consecutive_failures = 0;
+
+    while (running_.load()) {
+        AvahiDiscovery avahi;
+        avahi.owner = this;
+
+        auto browse_started = std::chrono::steady_clock::now();
+        int result = avahi.run();
+
+        if (result == AvahiDiscovery::kRunStopped || !running_.load()) {
+            return;
+        }
+        if (result == AvahiDiscovery::kRunNoDaemon) {
+            // Nothing to reconnect to (container, stripped-down host)
+            break;
+        }
+
+        // A browse that ran for a while before dying earns a fresh
+        // failure budget - only back-to-back failures count
+        if (std::chrono::steady_clock::now() - browse_started
+                > std::chrono::seconds(10)) {
+            consecutive_failures = 0;
+        }
+        if (++consecutive_failures >= kMaxConsecutiveFailures) {
+            log_warn("Discovery",
+                     "Avahi keeps failing; falling back to polling");
+            break;
+        }
+
+        log_warn("Discovery", "Avahi browse ended unexpectedly; reconnecting in 2 s");
+        for (int i = 0; i < 20 && running_.load(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    if (!running_.load()) {
+        return;
+    }
+    // Fall back to the old localhost probe so the proxy still finds a
+    // local Ollama
+#endif
+    // TODO: DNSServiceBrowse-based implementation for macOS
+    legacy_polling_loop();
+}
+
+void ServiceDiscovery::legacy_polling_loop() {
+    log_info("Discovery", "Falling back to localhost polling");
+
+    while (running_.load()) {
+        // Check if Ollama is running (common ZeroconfAI-compatible service)
+        auto [status, _] = http_get("http://localhost:11434/api/tags", 2);
+
+        if (status == 200) {
+            add_or_update_service(ServiceInfo("ollama-localhost", "127.0.0.1", 11434, 10));
+        }
+
+        // Clean up stale services (not seen in 30 seconds). Only the
+        // polling path needs this - the mDNS browse gets explicit
+        // goodbye events instead.
+        {
+            std::lock_guard<std::mutex> lock(services_mutex_);
+            auto now = std::chrono::system_clock::now();
+
+            // C++ doesn't let you modify a map while iterating, so collect keys to remove
+            std::vector<std::string> to_remove;
+
+            for (const auto& [name, service] : services_) {
+                auto age = std::chrono::duration_cast<std::chrono::seconds>(
+                    now - service.last_seen
+                ).count();
+
+                if (age > 30) {
+                    to_remove.push_back(name);
+                }
+            }
+
+            for (const auto& name : to_remove) {
+                log_info("Discovery", "Removing stale service: " + name);
+                services_.erase(name);
+            }
+            if (!to_remove.empty()) {
+                publish_snapshot();
+            }
+        }
+
+        // Sleep for 5 seconds between discovery attempts
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+    }
+}
+
+void ServiceDiscovery::health_check_loop() {
+    log_info("Health", "Starting health check loop");
+
+    // A backend is only declared unhealthy after this many failed
+    // probes in a row, so one dropped packet doesn't cause flapping;
+    // with the 3 s cycle below a dead backend is out within ~5 s
+    constexpr int kFailureThreshold = 2;
+
+    while (running_.load()) {
+        // Get copy of services to check
+        std::vector<ServiceInfo> services_to_check;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex_);
+            for (const auto& [name, service] : services_) {
+                services_to_check.push_back(service);
+            }
+        }
+
+        // Probe every service concurrently - one pass takes as long as
+        // the slowest single probe (bounded by its curl timeout), not
+        // the sum over the whole fleet
+        std::vector<char> results(services_to_check.size(), 0);
+        std::vector<char> natives(services_to_check.size(), 0);
+        std::vector<std::set<std::string>> model_lists(services_to_check.size());
+        std::vector<std::thread> probes;
+        probes.reserve(services_to_check.size());
+
+        for (size_t i = 0; i < services_to_check.size(); i++) {
+            probes.emplace_back([this, &services_to_check, &results, &natives,
+                                 &model_lists, i]() {
+                bool openai_native = false;
+                results[i] = check_health(services_to_check[i].url,
+                                          services_to_check[i].probe_endpoint,
+                                          openai_native, model_lists[i]) ? 1 : 0;
+                natives[i] = openai_native ? 1 : 0;
+            });
+        }
+        for (auto& probe : probes) {
+            probe.join();
+        }
+
+        // Apply all results under one lock
+        {
+            std::lock_guard<std::mutex> lock(services_mutex_);
+            bool changed = false;
+
+            for (size_t i = 0; i < services_to_check.size(); i++) {
+                auto it = services_.find(services_to_check[i].name);
+                if (it == services_.end()) continue;  // Removed mid-pass
+
+                ServiceInfo& service = it->second;
+                bool was_healthy = service.is_healthy;
+
+                // check_health updates the remembered endpoint in the
+                // copy; carry it back so the next pass gets the fast path
+                service.probe_endpoint = services_to_check[i].probe_endpoint;
+
+                if (results[i]) {
+                    service.consecutive_failures = 0;
+                    service.is_healthy = true;
+                    service.openai_native = natives[i] != 0;
+                    service.models = std::move(model_lists[i]);
+                } else {
+                    service.consecutive_failures++;
+                    if (service.consecutive_failures >= kFailureThreshold) {
+                        service.is_healthy = false;
+                    }
+                }
+
+                if (service.is_healthy != was_healthy) {
+                    log_info("Health", service.name + " is now " +
+                             (service.is_healthy ? "healthy" : "unhealthy"));
+                    changed = true;
+                }
+            }
+
+            if (changed) {
+                publish_snapshot();
+            }
+        }
+
+        // Short cycle, slept in small steps so stop() is noticed fast
+        for (int i = 0; i < 30 && running_.load(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+// Pull the backend's model inventory out of a successful probe
+// response - /api/tags lists names, /v1/models lists ids
+static void parse_model_inventory(int endpoint, const std::string& body,
+                                  std::set<std::string>& models) {
+    auto parsed = json::parse(body, nullptr, false);
+    if (parsed.is_discarded()) return;
+
+    if (endpoint == kProbeOllamaTags && parsed.contains("models")) {
+        for (const auto& model : parsed["models"]) {
+            models.insert(model.value("name", ""));
+        }
+    } else if (endpoint == kProbeOpenAiModels && parsed.contains("data")) {
+        for (const auto& model : parsed["data"]) {
+            models.insert(model.value("id", ""));
+        }
+    }
+}
+
+bool ServiceDiscovery::check_health(const std::string& url, int& probe_endpoint,
+                                    bool& openai_native, std::set<std::string>& models) {
+    // Steady state: the previous pass told us which dialect this
+    // backend speaks, so one request on the pooled (kept-alive)
+    // connection settles it. The probe response doubles as the
+    // backend's model inventory, so the index stays fresh for free.
+    if (probe_endpoint == kProbeOllamaTags || probe_endpoint == kProbeOpenAiModels) {
+        const char* path = probe_endpoint == kProbeOllamaTags ? "/api/tags" : "/v1/models";
+        auto [status, body] = http_get(url + path, 2);
+        if (status == 200) {
+            openai_native = (probe_endpoint == kProbeOpenAiModels);
+            parse_model_inventory(probe_endpoint, body, models);
+            return true;
+        }
+        // The remembered endpoint stopped answering - maybe the node
+        // was redeployed speaking the other dialect. Re-race below.
+        probe_endpoint = kProbeUnknown;
+    }
+
+    // First contact: race /api/tags and /v1/models concurrently on one
+    // curl_multi and take whichever answers 200 first. Probing them
+    // sequentially made every OpenAI-native backend eat a wasted
+    // failed /api/tags round-trip on every single pass.
+    struct Probe {
+        int endpoint;
+        std::string probe_url;
+        CURL* handle = nullptr;
+        std::string response;
+    };
+    Probe candidates[2] = {
+        {kProbeOllamaTags, url + "/api/tags", nullptr, {}},
+        {kProbeOpenAiModels, url + "/v1/models", nullptr, {}},
+    };
+
+    CURLM* multi = curl_multi_init();
+    if (!multi) return false;
+
+    int active = 0;
+    for (auto& probe : candidates) {
+        probe.handle = connection_pool().acquire(url);
+        if (!probe.handle) continue;
+        set_common_curl_options(probe.handle, probe.probe_url, 2);
+        curl_easy_setopt(probe.handle, CURLOPT_WRITEFUNCTION, curl_write_callback);
+        curl_easy_setopt(probe.handle, CURLOPT_WRITEDATA, &probe.response);
+        curl_multi_add_handle(multi, probe.handle);
+        active++;
+    }
+
+    Probe* winner = nullptr;
+    while (active > 0 && !winner) {
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        int msgs_left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &msgs_left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            active--;
+
+            long http_code = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+            if (msg->data.result == CURLE_OK && http_code == 200) {
+                for (auto& probe : candidates) {
+                    if (probe.handle == msg->easy_handle) winner = &probe;
+                }
+                break;  // First success wins; the loser is cut off below
+            }
+        }
+
+        if (active > 0 && !winner && still_running > 0) {
+            curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+        }
+    }
+
+    for (auto& probe : candidates) {
+        if (!probe.handle) continue;
+        curl_multi_remove_handle(multi, probe.handle);
+        // The losing transfer was torn down mid-flight, so its
+        // connection can't be trusted for reuse
+        connection_pool().release(url, probe.handle, &probe == winner);
+    }
+    curl_multi_cleanup(multi);
+
+    if (!winner) return false;
+
+    probe_endpoint = winner->endpoint;
+    openai_native = (winner->endpoint == kProbeOpenAiModels);
+    parse_model_inventory(winner->endpoint, winner->response, models);
+    return true;
+}
+
+ServiceDiscovery::ServiceSnapshot ServiceDiscovery::get_snapshot() const {
+    return std::atomic_load_explicit(&snapshot_, std::memory_order_acquire);
+}
+
+std::vector<ServiceInfo> ServiceDiscovery::get_services() const {
+    // The snapshot is already healthy-only and priority-sorted;
+    // callers that want their own copy just copy it
+    return *get_snapshot();
+}
+
+void ServiceDiscovery::report_forward_failure(const std::string& name) {
+    std::lock_guard<std::mutex> lock(services_mutex_);
+
+    auto it = services_.find(name);
+    if (it == services_.end()) return;
+
+    it->second.consecutive_failures++;
+    if (it->second.is_healthy && it->second.consecutive_failures >= 2) {
+        it->second.is_healthy = false;
+        log_warn("Health", name + " marked unhealthy after failed forwards");
+        publish_snapshot();
+    }
+}
+
+void ServiceDiscovery::inject_service(ServiceInfo info) {
+    std::lock_guard<std::mutex> lock(services_mutex_);
+    info.is_healthy = true;
+    services_.erase(info.name);
+    services_.emplace(info.name, std::move(info));
+    publish_snapshot();
+}
+
+size_t ServiceDiscovery::total_service_count() const {
+    std::lock_guard<std::mutex> lock(services_mutex_);
+    return services_.size();
+}
+
+std::optional<ServiceInfo> ServiceDiscovery::get_best_service() const {
+    auto snapshot = get_snapshot();
+    if (snapshot->empty()) {
+        return std::nullopt;  // Like returning None in Python
+    }
+    return snapshot->front();  // First element (highest priority)
+}
+
+// ============================================================================
+// Metrics Implementation
+// ============================================================================
+
+constexpr long Metrics::kBucketBoundsUs[];
+constexpr size_t Metrics::kNumBuckets;
+
+const char* Metrics::route_name(Route route) {
+    switch (route) {
+        case kRouteHealth:      return "health";
+        case kRouteModels:      return "models";
+        case kRouteCompletions: return "completions";
+        case kRouteEmbeddings:  return "embeddings";
+        default:                return "unknown";
+    }
+}
+
+void Metrics::record_request(Route route, long latency_us, bool error) {
+    RouteStats& stats = routes_[route];
+    stats.count.fetch_add(1, std::memory_order_relaxed);
+    if (error) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    stats.latency_sum_us.fetch_add(static_cast<uint64_t>(latency_us),
+                                   std::memory_order_relaxed);
+
+    // Non-cumulative buckets here; render() accumulates for the
+    // Prometheus "le" convention
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        if (latency_us <= kBucketBoundsUs[i]) {
+            stats.buckets[i].fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+}
+
+void Metrics::record_backend_error(const std::string& backend_name) {
+    std::lock_guard<std::mutex> lock(backend_mutex_);
+    backend_errors_[backend_name]++;
+}
+
+std::string Metrics::render(size_t services_discovered, size_t services_healthy,
+                            const std::map<std::string, int>& backend_inflight) const {
+    std::ostringstream out;
+
+    out << "# TYPE zeroconfai_requests_total counter\n";
+    out << "# TYPE zeroconfai_request_errors_total counter\n";
+    out << "# TYPE zeroconfai_request_latency_us histogram\n";
+
+    for (int r = 0; r < kRouteCount; r++) {
+        const RouteStats& stats = routes_[r];
+        const char* name = route_name(static_cast<Route>(r));
+
+        uint64_t count = stats.count.load(std::memory_order_relaxed);
+        out << "zeroconfai_requests_total{route=\"" << name << "\"} " << count << "\n";
+        out << "zeroconfai_request_errors_total{route=\"" << name << "\"} "
+            << stats.errors.load(std::memory_order_relaxed) << "\n";
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < kNumBuckets; i++) {
+            cumulative += stats.buckets[i].load(std::memory_order_relaxed);
+            out << "zeroconfai_request_latency_us_bucket{route=\"" << name
+                << "\",le=\"" << kBucketBoundsUs[i] << "\"} " << cumulative << "\n";
+        }
+        out << "zeroconfai_request_latency_us_bucket{route=\"" << name
+            << "\",le=\"+Inf\"} " << count << "\n";
+        out << "zeroconfai_request_latency_us_sum{route=\"" << name << "\"} "
+            << stats.latency_sum_us.load(std::memory_order_relaxed) << "\n";
+        out << "zeroconfai_request_latency_us_count{route=\"" << name << "\"} "
+            << count << "\n";
+    }
+
+    out << "# TYPE zeroconfai_backend_errors_total counter\n";
+    {
+        std::lock_guard<std::mutex> lock(backend_mutex_);
+        for (const auto& [backend, errors] : backend_errors_) {
+            out << "zeroconfai_backend_errors_total{backend=\"" << backend
+                << "\"} " << errors << "\n";
+        }
+    }
+
+    out << "# TYPE zeroconfai_backend_inflight gauge\n";
+    for (const auto& [backend, inflight] : backend_inflight) {
+        out << "zeroconfai_backend_inflight{backend=\"" << backend
+            << "\"} " << inflight << "\n";
+    }
+
+    out << "# TYPE zeroconfai_services_discovered gauge\n";
+    out << "zeroconfai_services_discovered " << services_discovered << "\n";
+    out << "# TYPE zeroconfai_services_healthy gauge\n";
+    out << "zeroconfai_services_healthy " << services_healthy << "\n";
+
+    return out.str();
+}
+
+// ============================================================================
+// ModelsCache Implementation
+// ============================================================================
+
+// How long an expired entry may linger before the sweep removes it.
+// The grace window exists because a stale body still beats an error
+// when a refresh of the same key fails (see below); anything older
+// than this is a dead key nobody is coming back for.
+static constexpr int kModelsCacheStaleGraceSeconds = 300;
+
+std::string ModelsCache::get_or_fetch(const std::string& key,
+                                      int ttl_seconds,
+                                      const std::function<std::string()>& fetch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Sweep dead entries. The key is the fleet's URL list, so every
+    // topology change mints a new one - without eviction the map
+    // grows without bound on a fleet with churn, each entry holding a
+    // full rendered models listing. In-progress fetches are skipped
+    // so their waiters don't end up on a fresh entry.
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (!it->second.fetch_in_progress &&
+            now >= it->second.expires +
+                   std::chrono::seconds(kModelsCacheStaleGraceSeconds)) {
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (;;) {
+        Entry& entry = entries_[key];
+
+        if (!entry.body.empty() &&
+            std::chrono::steady_clock::now() < entry.expires) {
+            return entry.body;  // Fresh hit - no upstream traffic
+        }
+
+        if (!entry.fetch_in_progress) {
+            entry.fetch_in_progress = true;
+            break;  // This caller does the fetch
+        }
+
+        // Someone else is already fetching this key - wait for their
+        // result rather than issuing a duplicate upstream request
+        fetch_done_.wait(lock);
+    }
+
+    // Fetch without holding the lock so a slow backend doesn't block
+    // hits on other keys
+    lock.unlock();
+    std::string fresh;
+    try {
+        fresh = fetch();
+    } catch (...) {
+        // Treated as a failed fetch below
+    }
+    lock.lock();
+
+    Entry& entry = entries_[key];
+    entry.fetch_in_progress = false;
+    if (!fresh.empty()) {
+        entry.body = fresh;
+        entry.expires = std::chrono::steady_clock::now()
+                      + std::chrono::seconds(ttl_seconds);
+    }
+    fetch_done_.notify_all();
+
+    // On a failed fetch, a stale body (if any) beats an error
+    return !fresh.empty() ? fresh : entry.body;
+}
+
+// ============================================================================
+// CompletionCache Implementation
+// ============================================================================
+
+std::optional<std::string> CompletionCache::get(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = entries_.find(key);
+    if (it == entries_.end()) return std::nullopt;
+
+    if (std::chrono::steady_clock::now() >= it->second.expires) {
+        lru_.erase(it->second.lru_position);
+        entries_.erase(it);
+        return std::nullopt;
+    }
+
+    // Refresh recency
+    lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+    return it->second.response;
+}
+
+void CompletionCache::put(uint64_t key, std::string response, int ttl_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto expires = std::chrono::steady_clock::now()
+                 + std::chrono::seconds(ttl_seconds);
+
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        it->second.response = std::move(response);
+        it->second.expires = expires;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+        return;
+    }
+
+    while (entries_.size() >= max_entries_ && !lru_.empty()) {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+    }
+
+    lru_.push_front(key);
+    entries_.emplace(key, Entry{std::move(response), expires, lru_.begin()});
+}
+
+// FNV-1a, 64-bit - fast, no dependency, and collisions at cache scale
+// (hundreds of entries) are vanishingly unlikely
+static uint64_t fnv1a_hash(const std::string& data) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char byte : data) {
+        hash ^= byte;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Content address for a deterministic completion request. Returns
+// nullopt unless temperature is exactly 0 - anything sampled is not
+// replayable. Only the fields that determine the output go into the
+// key, serialized through nlohmann (which sorts keys), so formatting
+// and key-order differences don't split identical requests.
+static std::optional<uint64_t> completion_cache_key(const std::string& body) {
+    auto parsed = json::parse(body, nullptr, false);
+    if (parsed.is_discarded() || !parsed.is_object()) return std::nullopt;
+
+    if (!parsed.contains("temperature") || !parsed["temperature"].is_number() ||
+        parsed["temperature"].get<double>() != 0.0) {
+        return std::nullopt;
+    }
+
+    json canonical = json::object();
+    for (const char* field : {"model", "messages", "temperature", "top_p",
+                              "max_tokens", "n", "stop", "seed",
+                              "presence_penalty", "frequency_penalty"}) {
+        if (parsed.contains(field)) {
+            canonical[field] = parsed[field];
+        }
+    }
+    return fnv1a_hash(canonical.dump());
+}
+
+// ============================================================================
+// Router Implementation
+// ============================================================================
+
+Router::Router(std::shared_ptr<ServiceDiscovery> discovery,
+               int default_max_concurrent)
+    : discovery_(std::move(discovery)),
+      default_max_concurrent_(default_max_concurrent) {}
+
+std::shared_ptr<Router::BackendStats> Router::stats_for(const std::string& backend_name) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    auto& entry = stats_[backend_name];
+    if (!entry) {
+        entry = std::make_shared<BackendStats>();
+    }
+    return entry;
+}
+
+bool Router::less_loaded(const BackendStats& lhs, const BackendStats& rhs) {
+    int lhs_inflight = lhs.inflight.load(std::memory_order_relaxed);
+    int rhs_inflight = rhs.inflight.load(std::memory_order_relaxed);
+    if (lhs_inflight != rhs_inflight) {
+        return lhs_inflight < rhs_inflight;
+    }
+    // Tie-break on recent completion latency (0 = unknown, treat as
+    // fast so new backends get a chance to prove themselves)
+    return lhs.ewma_latency_ms.load(std::memory_order_relaxed)
+         < rhs.ewma_latency_ms.load(std::memory_order_relaxed);
+}
+
+std::optional<ServiceInfo> Router::select_backend(const std::string& model) {
+    auto snapshot = discovery_->get_snapshot();
+    if (snapshot->empty()) {
+        return std::nullopt;
+    }
+
+    // Prefer backends that already have the requested model resident -
+    // routing to one that must cold-pull or swap costs 10-60 s before
+    // the first token. Fall back to everyone if nobody hosts it (the
+    // backend will load it, someone has to).
+    std::vector<const ServiceInfo*> pool;
+    pool.reserve(snapshot->size());
+    if (!model.empty()) {
+        for (const auto& service : *snapshot) {
+            if (service.models.count(model)) {
+                pool.push_back(&service);
+            }
+        }
+    }
+    if (pool.empty()) {
+        for (const auto& service : *snapshot) {
+            pool.push_back(&service);
+        }
+    }
+
+    // The pool keeps the snapshot's priority order, so the best tier
+    // is the prefix sharing the front's priority. Operator preference
+    // still wins; load only balances within a tier.
+    size_t tier_end = 1;
+    while (tier_end < pool.size() &&
+           pool[tier_end]->priority == pool[0]->priority) {
+        tier_end++;
+    }
+
+    if (tier_end == 1) {
+        return *pool[0];
+    }
+
+    // Power of two choices within the tier
+    thread_local std::minstd_rand rng(std::random_device{}());
+    std::uniform_int_distribution<size_t> dist(0, tier_end - 1);
+
+    size_t a = dist(rng);
+    size_t b = dist(rng);
+    if (a == b) {
+        b = (b + 1) % tier_end;
+    }
+
+    auto stats_a = stats_for(pool[a]->name);
+    auto stats_b = stats_for(pool[b]->name);
+
+    return less_loaded(*stats_b, *stats_a) ? *pool[b] : *pool[a];
+}
+
+int Router::limit_for(const ServiceInfo& backend) const {
+    return backend.max_concurrent > 0 ? backend.max_concurrent
+                                      : default_max_concurrent_;
+}
+
+bool Router::try_reserve(const ServiceInfo& backend) {
+    auto stats = stats_for(backend.name);
+    int limit = limit_for(backend);
+    if (limit <= 0) {
+        // Uncapped - the reservation is just the in-flight increment
+        stats->inflight.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    // CAS loop so two requests racing for the last slot can't both
+    // get it - this is the counting-semaphore acquire
+    int current = stats->inflight.load(std::memory_order_relaxed);
+    while (current < limit) {
+        if (stats->inflight.compare_exchange_weak(current, current + 1,
+                                                  std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::optional<ServiceInfo> Router::acquire_backend(const std::string& model,
+                                                   int wait_ms) {
+    auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(wait_ms);
+
+    while (true) {
+        auto target = select_backend(model);
+        if (!target) {
+            return std::nullopt;  // Nobody healthy at all
+        }
+        if (try_reserve(*target)) {
+            return target;
+        }
+
+        // The preferred pick is saturated - spill to any other backend
+        // with a free slot, in priority order. An idle lower-priority
+        // (or wrong-model) node beats queueing behind a full one.
+        auto snapshot = discovery_->get_snapshot();
+        for (const auto& service : *snapshot) {
+            if (service.name != target->name && try_reserve(service)) {
+                return service;
+            }
+        }
+
+        // Everyone is at their limit: short bounded wait for a finish
+        // to free a slot, then re-scan. A finish racing in just before
+        // we sleep only costs one wakeup-or-deadline latency, so no
+        // lock is held across the saturation scan above.
+        std::unique_lock<std::mutex> lock(admission_mutex_);
+        if (admission_cv_.wait_until(lock, deadline)
+                == std::cv_status::timeout) {
+            return std::nullopt;
+        }
+    }
+}
+
+void Router::on_request_start(const std::string& backend_name) {
+    stats_for(backend_name)->inflight.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Router::on_request_finish(const std::string& backend_name,
+                               long latency_ms, bool success) {
+    auto stats = stats_for(backend_name);
+    stats->inflight.fetch_sub(1, std::memory_order_relaxed);
+    // Wake admission waiters - cheap when nobody is parked
+    admission_cv_.notify_all();
+
+    if (success && latency_ms >= 0) {
+        // Exponential moving average with alpha = 1/8. The lost-update
+        // race between concurrent finishes is harmless for a smoothed
+        // load signal, so no CAS loop.
+        long previous = stats->ewma_latency_ms.load(std::memory_order_relaxed);
+        long updated = (previous == 0)
+            ? latency_ms
+            : (previous * 7 + latency_ms) / 8;
+        stats->ewma_latency_ms.store(updated, std::memory_order_relaxed);
+    }
+}
+
+int Router::inflight(const std::string& backend_name) const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    auto it = stats_.find(backend_name);
+    return it == stats_.end() ? 0
+        : it->second->inflight.load(std::memory_order_relaxed);
+}
+
+std::map<std::string, int> Router::inflight_counts() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    std::map<std::string, int> counts;
+    for (const auto& [backend, stats] : stats_) {
+        counts[backend] = stats->inflight.load(std::memory_order_relaxed);
+    }
+    return counts;
+}
+
+// ============================================================================
+// EmbeddingBatcher Implementation
+// ============================================================================
+
+std::pair<int, std::string> EmbeddingBatcher::embed(const std::string& model,
+                                                    std::vector<std::string> inputs,
+                                                    int window_ms,
+                                                    int timeout_seconds) {
+    auto call = std::make_shared<PendingCall>();
+    std::shared_ptr<OpenBatch> batch;
+    bool leader = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& slot = open_batches_[model];
+        if (!slot) {
+            slot = std::make_shared<OpenBatch>();
+            slot->model = model;
+            leader = true;
+        }
+        batch = slot;
+        call->offset = batch->inputs.size();
+        call->count = inputs.size();
+        for (auto& text : inputs) {
+            batch->inputs.push_back(std::move(text));
+        }
+        batch->calls.push_back(call);
+    }
+
+    if (!leader) {
+        // A leader is already holding the window open; wait for it to
+        // dispatch the batch and hand back our slice
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&call] { return call->done; });
+        return {call->status, std::move(call->response)};
+    }
+
+    // Leader: hold the window open briefly so a burst of callers
+    // coalesces, then close the batch to new arrivals and dispatch
+    std::this_thread::sleep_for(std::chrono::milliseconds(window_ms));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_batches_.erase(model);
+    }
+
+    dispatch(*batch, timeout_seconds);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& pending : batch->calls) {
+            pending->done = true;
+        }
     }
+    done_cv_.notify_all();
+
+    return {call->status, std::move(call->response)};
 }
 
-void ServiceDiscovery::health_check_loop() {
-    std::cout << "[Health] Starting health check loop" << std::endl;
-    
-    while (running_.load()) {
-        // Get copy of services to check
-        std::vector<ServiceInfo> services_to_check;
-        {
-            std::lock_guard<std::mutex> lock(services_mutex_);
-            for (const auto& [name, service] : services_) {
-                services_to_check.push_back(service);
+void EmbeddingBatcher::fail_batch(OpenBatch& batch, int status,
+                                  const std::string& message) {
+    json error = {{"error", message}};
+    std::string rendered = error.dump();
+    for (auto& call : batch.calls) {
+        call->status = status;
+        call->response = rendered;
+    }
+}
+
+void EmbeddingBatcher::dispatch(OpenBatch& batch, int timeout_seconds) {
+    auto target = router_->select_backend(batch.model);
+    if (!target) {
+        fail_batch(batch, 503, "No healthy ZeroconfAI services available");
+        return;
+    }
+
+    json input_array = json::array();
+    for (const auto& text : batch.inputs) {
+        input_array.push_back(text);
+    }
+    json forward = {
+        {"model", batch.model},
+        {"input", input_array}
+    };
+
+    // Both dialects take {model, input: [...]}; only the path and the
+    // response shape differ
+    std::string backend_url = target->url +
+        (target->openai_native ? "/v1/embeddings" : "/api/embed");
+
+    router_->on_request_start(target->name);
+    auto started = std::chrono::steady_clock::now();
+    auto [status, body] = http_post(backend_url, forward.dump(), timeout_seconds);
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    router_->on_request_finish(target->name, elapsed_ms,
+                               status >= 200 && status < 500);
+
+    if (status != 200) {
+        discovery_->report_forward_failure(target->name);
+        fail_batch(batch, 502, "Embedding backend failed");
+        return;
+    }
+
+    // Collect the vectors in merged-input order
+    auto parsed = json::parse(body, nullptr, false);
+    json vectors = json::array();
+    if (!parsed.is_discarded()) {
+        if (target->openai_native && parsed.contains("data")) {
+            for (size_t i = 0; i < batch.inputs.size(); i++) {
+                vectors.push_back(json());
             }
-        }
-        
-        // Check health of each service
-        for (const auto& service : services_to_check) {
-            bool healthy = check_health(service.url);
-            
-            // Update health status
-            std::lock_guard<std::mutex> lock(services_mutex_);
-            auto it = services_.find(service.name);
-            if (it != services_.end()) {
-                bool was_healthy = it->second.is_healthy;
-                it->second.is_healthy = healthy;
-                
-                if (healthy != was_healthy) {
-                    std::cout << "[Health] " << service.name 
-                             << " is now " << (healthy ? "healthy" : "unhealthy") << std::endl;
+            for (const auto& entry : parsed["data"]) {
+                size_t index = entry.value("index", 0u);
+                if (index < batch.inputs.size()) {
+                    vectors[index] = entry.value("embedding", json::array());
                 }
             }
+        } else if (parsed.contains("embeddings")) {
+            vectors = parsed["embeddings"];
         }
-        
-        // Sleep for 10 seconds between health checks
-        std::this_thread::sleep_for(std::chrono::seconds(10));
     }
-}
-
-bool ServiceDiscovery::check_health(const std::string& url) {
-    // Try to hit the /api/tags endpoint (Ollama-style)
-    // Most OpenAI-compatible services have either /v1/models or /api/tags
-    auto [status, _] = http_get(url + "/api/tags", 3);
-    
-    if (status == 200) return true;
-    
-    // Try alternative health check endpoint
-    auto [status2, __] = http_get(url + "/v1/models", 3);
-    return (status2 == 200);
-}
 
-std::vector<ServiceInfo> ServiceDiscovery::get_services() const {
-    std::lock_guard<std::mutex> lock(services_mutex_);
-    
-    std::vector<ServiceInfo> result;
-    
-    // Only return healthy services
-    for (const auto& [name, service] : services_) {
-        if (service.is_healthy) {
-            result.push_back(service);
-        }
+    if (vectors.size() != batch.inputs.size()) {
+        fail_batch(batch, 502, "Embedding backend returned wrong result count");
+        return;
     }
-    
-    // Sort by priority (lower number = higher priority)
-    std::sort(result.begin(), result.end());
-    
-    return result;
-}
 
-std::optional<ServiceInfo> ServiceDiscovery::get_best_service() const {
-    auto services = get_services();
-    if (services.empty()) {
-        return std::nullopt;  // Like returning None in Python
+    // Split the batch back per caller, re-indexed from zero
+    for (auto& call : batch.calls) {
+        json data = json::array();
+        for (size_t i = 0; i < call->count; i++) {
+            data.push_back({
+                {"object", "embedding"},
+                {"index", i},
+                {"embedding", vectors[call->offset + i]}
+            });
+        }
+        json response = {
+            {"object", "list"},
+            {"data", data},
+            {"model", batch.model},
+            {"usage", {{"prompt_tokens", 0}, {"total_tokens", 0}}}
+        };
+        call->status = 200;
+        call->response = response.dump();
     }
-    return services[0];  // First element (highest priority)
 }
 
 // ============================================================================
@@ -280,9 +2640,21 @@ std::optional<ServiceInfo> ServiceDiscovery::get_best_service() const {
 // ============================================================================
 
 ProxyServer::ProxyServer(const ProxyConfig& config)
-    : config_(config), running_(false) {
-    
-    discovery_ = std::make_shared<ServiceDiscovery>();
+    : config_(config), completion_cache_(config.completion_cache_max_entries),
+      running_(false), inflight_completions_(0) {
+
+    discovery_ = std::make_shared<ServiceDiscovery>(config_.use_shared_service_table);
+    router_ = std::make_shared<Router>(discovery_,
+                                       config_.backend_max_concurrent);
+    embedding_batcher_ = std::make_shared<EmbeddingBatcher>(discovery_, router_);
+}
+
+int ProxyServer::completion_capacity() const {
+    if (config_.max_inflight_completions > 0) {
+        return config_.max_inflight_completions;
+    }
+    // Leave a couple of workers free for the cheap routes
+    return std::max(1, config_.worker_threads - 2);
 }
 
 ProxyServer::~ProxyServer() {
@@ -291,38 +2663,142 @@ ProxyServer::~ProxyServer() {
 
 void ProxyServer::start() {
     if (running_.load()) return;
-    
-    // Start service discovery
+
+    // Logging first: everything below (discovery, health, routing)
+    // reports through it. --quiet keeps warnings and errors only;
+    // request-level lines are cheap enough to leave on in production.
+    Logger::instance().set_level(config_.verbose ? Logger::kInfo : Logger::kWarn);
+    Logger::instance().start();
+
+    // Event loop for streaming backend transfers
+    TransferEngine::instance().start();
+
+    // Start service discovery and the HTTP server concurrently - no
+    // startup sleep. Until discovery lands its first healthy service
+    // the routes simply answer 503, which a supervisor or client
+    // retry handles far better than seconds of refused connections.
     discovery_->start();
-    
-    // Give discovery a moment to find services
-    std::cout << "[Proxy] Waiting for service discovery..." << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    
+
     running_.store(true);
-    
-    // Start the HTTP server in a separate thread
+
+    // The Server objects exist before their threads do, so a stop()
+    // arriving right after start() (supervisor flap, SIGTERM during
+    // startup) always finds something to call Server::stop() on
+    http_server_ = std::make_unique<httplib::Server>();
+    configure_routes(*http_server_);
     server_thread_ = std::thread(&ProxyServer::run_server, this);
+
+    // Optional second listener on a Unix domain socket for same-host
+    // clients (see run_unix_server)
+    if (!config_.unix_socket_path.empty()) {
+        uds_server_ = std::make_unique<httplib::Server>();
+        configure_routes(*uds_server_);
+        uds_thread_ = std::thread(&ProxyServer::run_unix_server, this);
+    }
+}
+
+void ProxyServer::wait_until_stopped() const {
+    // Woken by request_stop() from the signal handler; 100 ms polling
+    // keeps this signal-safe (no cv notify from the handler) while
+    // still reacting to Ctrl+C essentially instantly
+    while (running_.load() && !stop_requested_.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
 }
 
 void ProxyServer::stop() {
-    if (!running_.load()) return;
-    
-    running_.store(false);
-    discovery_->stop();
-    
+    if (!running_.exchange(false)) return;
+
+    // Arm the drain deadline before anything blocks. The joins below
+    // wait for handlers already running, and a buffered forward can
+    // sit in http_post() for up to completion_timeout_seconds - its
+    // cancel callback polls shutdown_drain_expired(), so once the
+    // window passes the transfer aborts and the handler unwinds.
+    shutdown_deadline_ = std::chrono::steady_clock::now()
+                       + std::chrono::seconds(config_.drain_timeout_seconds);
+    shutting_down_.store(true);
+
+    // 1. Stop accepting: break the listen loop. httplib finishes the
+    //    handlers that are already running before listen() returns.
+    if (http_server_) {
+        http_server_->stop();
+    }
+    if (uds_server_) {
+        uds_server_->stop();
+    }
     if (server_thread_.joinable()) {
         server_thread_.join();
     }
-    
-    std::cout << "[Proxy] Server stopped" << std::endl;
+    if (uds_thread_.joinable()) {
+        uds_thread_.join();
+    }
+
+    // 2. Drain: streaming transfers run past their handler on
+    //    detached threads - give them up to the configured window to
+    //    deliver what the backend is still generating
+    auto deadline = std::chrono::steady_clock::now()
+                  + std::chrono::seconds(config_.drain_timeout_seconds);
+    while (inflight_completions_.load() > 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (inflight_completions_.load() > 0) {
+        log_warn("Proxy", "Drain timeout - abandoning " +
+                 std::to_string(inflight_completions_.load()) + " in-flight generation(s)");
+    }
+
+    // 3. The drain window is over - abort any transfer still running
+    //    so its on_done unwinds the in-flight accounting
+    TransferEngine::instance().stop();
+
+    // 4. Only now take discovery down
+    discovery_->stop();
+
+    log_info("Proxy", "Server stopped");
+
+    // Last: flush and stop the log writer so the line above lands
+    Logger::instance().stop();
 }
 
-void ProxyServer::run_server() {
-    // Create HTTP server using cpp-httplib
-    // This is similar to Flask or FastAPI in Python
-    httplib::Server server;
-    
+bool ProxyServer::shutdown_drain_expired() const {
+    return shutting_down_.load() &&
+           std::chrono::steady_clock::now() >= shutdown_deadline_;
+}
+
+// Records a handler's latency and outcome when it goes out of scope
+// (like a with-block in Python) - keeps the timing one line per route
+struct RequestTimer {
+    Metrics& metrics;
+    Metrics::Route route;
+    httplib::Response& res;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    ~RequestTimer() {
+        auto latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        metrics.record_request(route, latency_us, res.status >= 400);
+    }
+};
+
+// Everything route-related lives here so the TCP and the Unix-socket
+// listeners expose the identical API - one httplib::Server instance
+// can only listen on one socket, so each listener gets its own,
+// configured by this method.
+void ProxyServer::configure_routes(httplib::Server& server) {
+    // Backstop limit at the HTTP layer; the completions handler also
+    // checks explicitly so oversized bodies get a JSON 413 rather
+    // than a dropped connection
+    server.set_payload_max_length(config_.max_request_body_bytes);
+
+    // Explicit worker pool with a bounded accept queue, replacing
+    // httplib's defaults. Connections beyond the queue bound are
+    // refused at accept time instead of piling up unboundedly.
+    server.new_task_queue = [this] {
+        return new httplib::ThreadPool(
+            static_cast<size_t>(std::max(1, config_.worker_threads)),
+            static_cast<size_t>(std::max(0, config_.max_queued_requests)));
+    };
+
     // Enable CORS if requested
     if (config_.enable_cors) {
         server.set_default_headers({
@@ -335,7 +2811,8 @@ void ProxyServer::run_server() {
     // ========================================================================
     // Route: GET /v1/health
     // ========================================================================
-    server.Get("/v1/health", [this](const httplib::Request& req, httplib::Response& res) {
+    server.Get("/v1/health", [this](const httplib::Request&, httplib::Response& res) {
+        RequestTimer timer{metrics_, Metrics::kRouteHealth, res};
         auto services = discovery_->get_services();
         
         json response = {
@@ -348,10 +2825,23 @@ void ProxyServer::run_server() {
         res.status = services.empty() ? 503 : 200;
     });
     
+    // ========================================================================
+    // Route: GET /metrics (Prometheus scrape endpoint)
+    // ========================================================================
+    server.Get("/metrics", [this](const httplib::Request&, httplib::Response& res) {
+        auto snapshot = discovery_->get_snapshot();
+        res.set_content(
+            metrics_.render(discovery_->total_service_count(),
+                            snapshot->size(),
+                            router_->inflight_counts()),
+            "text/plain; version=0.0.4");
+    });
+
     // ========================================================================
     // Route: GET /v1/models
     // ========================================================================
-    server.Get("/v1/models", [this](const httplib::Request& req, httplib::Response& res) {
+    server.Get("/v1/models", [this](const httplib::Request&, httplib::Response& res) {
+        RequestTimer timer{metrics_, Metrics::kRouteModels, res};
         auto services = discovery_->get_services();
         
         if (services.empty()) {
@@ -361,106 +2851,459 @@ void ProxyServer::run_server() {
             return;
         }
         
-        // For simplicity, just forward to the best service
-        auto best = discovery_->get_best_service();
-        if (!best) {
-            json error = {{"error", "No healthy services"}};
-            res.set_content(error.dump(), "application/json");
-            res.status = 503;
-            return;
-        }
-        
-        if (config_.verbose) {
-            std::cout << "[Proxy] Fetching models from " << best->name << std::endl;
+        // Aggregate across every healthy backend, not just the best
+        // one - a model that only lives on one LAN node should still
+        // show up in Jan's picker. Cached keyed by the topology, so a
+        // service joining or leaving invalidates the merged listing;
+        // on a miss only one request does the fan-out, the rest
+        // coalesce onto its result.
+        std::string cache_key;
+        for (const auto& service : services) {
+            cache_key += service.url;
+            cache_key += '|';
         }
-        
-        auto [status, body] = http_get(best->url + "/api/tags");
-        
-        if (status != 200) {
+
+        std::string cached = models_cache_.get_or_fetch(
+            cache_key, config_.models_cache_ttl_seconds, [&services]() -> std::string {
+                log_info("Proxy", "Aggregating models from " +
+                         std::to_string(services.size()) + " backend(s)");
+
+                // One deadline bounds the whole fan-out: the fetches
+                // run concurrently under the same timeout, so the
+                // route costs at most one slow backend, not the sum
+                // over the fleet
+                constexpr int kFanoutTimeoutSeconds = 2;
+
+                std::vector<std::pair<int, std::string>> replies(services.size());
+                std::vector<std::thread> fetches;
+                fetches.reserve(services.size());
+
+                for (size_t i = 0; i < services.size(); i++) {
+                    fetches.emplace_back([&services, &replies, i]() {
+                        const char* path = services[i].openai_native
+                                         ? "/v1/models" : "/api/tags";
+                        replies[i] = http_get(services[i].url + path,
+                                              kFanoutTimeoutSeconds);
+                    });
+                }
+                for (auto& fetch : fetches) {
+                    fetch.join();
+                }
+
+                // Merge and de-duplicate. services is priority-sorted,
+                // so the first backend reporting a model claims the
+                // owned_by tag.
+                json merged = json::array();
+                std::set<std::string> seen;
+                bool any_success = false;
+
+                for (size_t i = 0; i < services.size(); i++) {
+                    const auto& [status, body] = replies[i];
+                    if (status != 200) continue;
+                    any_success = true;
+
+                    std::set<std::string> names;
+                    parse_model_inventory(services[i].openai_native
+                                          ? kProbeOpenAiModels : kProbeOllamaTags,
+                                          body, names);
+
+                    for (const auto& name : names) {
+                        if (name.empty() || !seen.insert(name).second) continue;
+                        merged.push_back({
+                            {"id", name},
+                            {"object", "model"},
+                            {"created", 0},
+                            {"owned_by", services[i].name}
+                        });
+                    }
+                }
+
+                if (!any_success) {
+                    return "";  // Every fetch failed - cache serves stale if it can
+                }
+
+                json response = {
+                    {"object", "list"},
+                    {"data", merged}
+                };
+                return response.dump(2);
+            });
+
+        if (cached.empty()) {
             json error = {{"error", "Failed to fetch models"}};
             res.set_content(error.dump(), "application/json");
             res.status = 502;
             return;
         }
-        
-        // Parse Ollama response and convert to OpenAI format
-        try {
-            auto ollama_response = json::parse(body);
-            json openai_models = json::array();
-            
-            if (ollama_response.contains("models")) {
-                for (const auto& model : ollama_response["models"]) {
-                    std::string model_name = model.value("name", "unknown");
-                    openai_models.push_back({
-                        {"id", model_name},
-                        {"object", "model"},
-                        {"created", 0},
-                        {"owned_by", "zeroconfai"}
-                    });
-                }
-            }
-            
-            json response = {
-                {"object", "list"},
-                {"data", openai_models}
-            };
-            
-            res.set_content(response.dump(2), "application/json");
-            
-        } catch (const std::exception& e) {
-            json error = {{"error", std::string("Parse error: ") + e.what()}};
-            res.set_content(error.dump(), "application/json");
-            res.status = 500;
-        }
+
+        res.set_content(cached, "application/json");
     });
     
     // ========================================================================
     // Route: POST /v1/chat/completions
     // ========================================================================
     server.Post("/v1/chat/completions", [this](const httplib::Request& req, httplib::Response& res) {
+        RequestTimer timer{metrics_, Metrics::kRouteCompletions, res};
+
+        if (req.body.size() > config_.max_request_body_bytes) {
+            json error = {{"error", "Request body too large"}};
+            res.set_content(error.dump(), "application/json");
+            res.status = 413;
+            return;
+        }
+
+        // All DOM work below (parse, translate, convert back) draws
+        // from this request's arena instead of the global allocator -
+        // no malloc contention between workers, one wholesale free
+        ArenaScope arena_scope;
+
+        // Deterministic replays are served straight from the
+        // completion cache - before shedding, because a hit costs
+        // microseconds and no generation slot
+        std::optional<uint64_t> cache_key;
+        if (config_.enable_completion_cache && !body_requests_stream(req.body)) {
+            cache_key = completion_cache_key(req.body);
+            if (cache_key) {
+                if (auto hit = completion_cache_.get(*cache_key)) {
+                    res.set_content(*hit, "application/json");
+                    return;
+                }
+            }
+        }
+
+        // Overload shedding: when every generation slot is busy, answer
+        // 503 immediately rather than queueing behind 120 s forwards
+        if (inflight_completions_.fetch_add(1) >= completion_capacity()) {
+            inflight_completions_.fetch_sub(1);
+            json error = {{"error", "Proxy at capacity, retry shortly"}};
+            res.set_header("Retry-After", "1");
+            res.set_content(error.dump(), "application/json");
+            res.status = 503;
+            return;
+        }
+
+        // Decrement when the handler exits, whichever path it takes
+        // (like a finally: block in Python)
+        struct InflightGuard {
+            std::atomic<int>& counter;
+            ~InflightGuard() { counter.fetch_sub(1); }
+        } guard{inflight_completions_};
+
         try {
-            // Get the best service to route to
-            auto target = discovery_->get_best_service();
-            
+            // Ask the router for a backend - least loaded within the
+            // best priority tier, preferring nodes that already have
+            // the requested model resident. acquire_backend also
+            // reserves a generation slot against the backend's
+            // concurrency limit (TXT max_concurrent, else the config
+            // default), spilling or briefly queueing when full.
+            std::string requested_model = extract_model_field(req.body);
+            auto target = router_->acquire_backend(requested_model,
+                                                   config_.admission_wait_ms);
+
             if (!target) {
-                json error = {{"error", "No healthy ZeroconfAI services available"}};
+                if (discovery_->get_snapshot()->empty()) {
+                    json error = {{"error", "No healthy ZeroconfAI services available"}};
+                    res.set_content(error.dump(), "application/json");
+                    res.status = 503;
+                    return;
+                }
+                // Backends exist but every slot stayed busy for the
+                // whole admission wait - shed rather than pile more
+                // work onto boxes already at their parallel limit
+                json error = {{"error", "All backends at capacity, retry shortly"}};
+                res.set_header("Retry-After", "1");
                 res.set_content(error.dump(), "application/json");
                 res.status = 503;
                 return;
             }
-            
-            if (config_.verbose) {
-                std::cout << "[Proxy] Routing chat completion to " << target->name << std::endl;
-            }
-            
-            // Parse incoming OpenAI request
-            auto request_json = json::parse(req.body);
-            
-            // Convert OpenAI format to Ollama format
-            json ollama_request = {
-                {"model", request_json.value("model", "llama2")},
-                {"messages", request_json["messages"]},
-                {"stream", request_json.value("stream", false)}
+
+            // The reserved slot must be released by exactly one
+            // on_request_finish. Each forward path takes ownership and
+            // disarms this; it only fires if we bail out (or throw)
+            // before any forward starts.
+            struct SlotGuard {
+                Router& router;
+                std::string backend;
+                bool armed = true;
+                ~SlotGuard() {
+                    if (armed) router.on_request_finish(backend, -1, false);
+                }
+            } slot_guard{*router_, target->name};
+
+            log_info("Proxy", "Routing chat completion to " + target->name);
+
+            bool wants_stream = body_requests_stream(req.body);
+
+            // Users cancel generations constantly. httplib can tell us
+            // the socket is gone; wire that through to curl so the
+            // worker and the backend GPU are freed the moment the
+            // client hangs up, not two minutes later. The same hook
+            // bounds shutdown: once stop()'s drain window expires the
+            // forward aborts instead of pinning the join for the full
+            // completion timeout.
+            std::function<bool()> client_gone = [this, &req]() {
+                return (req.is_connection_closed && req.is_connection_closed())
+                    || shutdown_drain_expired();
             };
-            
-            // Forward to Ollama
-            auto [status, body] = http_post(
-                target->url + "/api/chat",
-                ollama_request.dump()
-            );
-            
-            if (status == 0 || status >= 500) {
-                json error = {{"error", "Backend service unavailable"}};
+
+            // ----------------------------------------------------------------
+            // Streaming paths. The stream is committed to one backend -
+            // failover below only applies to buffered forwards, where no
+            // bytes have reached the client yet.
+            // ----------------------------------------------------------------
+            if (wants_stream && target->openai_native) {
+                // Fast path: the backend speaks OpenAI natively, relay
+                // its SSE bytes untouched
+                std::string backend_url = target->url + "/v1/chat/completions";
+                auto relay = std::make_shared<StreamRelay>();
+                std::string raw_body = req.body;
+                std::string backend_name = target->name;
+
+                inflight_completions_.fetch_add(1);
+                slot_guard.armed = false;  // on_done releases the slot
+                auto started = std::chrono::steady_clock::now();
+                TransferEngine::instance().submit_post(
+                    backend_url, std::move(raw_body),
+                    config_.completion_timeout_seconds,
+                    [relay](const char* data, size_t len) -> int {
+                        // Already OpenAI SSE - relay the bytes
+                        // untouched. On a full queue nothing was
+                        // consumed; libcurl re-delivers after resume.
+                        switch (relay->try_push(std::string(data, len))) {
+                            case StreamRelay::kPushOk:
+                                return TransferEngine::kDataContinue;
+                            case StreamRelay::kPushFull:
+                                return TransferEngine::kDataPause;
+                            default:
+                                return TransferEngine::kDataAbort;
+                        }
+                    },
+                    [this, relay, backend_name, started](bool success, long) {
+                        relay->close();
+                        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - started).count();
+                        router_->on_request_finish(backend_name, elapsed_ms, success);
+                        inflight_completions_.fetch_sub(1);
+                    },
+                    [relay]() { return relay->is_cancelled(); });
+
+                res.set_chunked_content_provider(
+                    "text/event-stream",
+                    [relay](size_t /*offset*/, httplib::DataSink& sink) {
+                        std::string chunk;
+                        if (!relay->pop(chunk)) {
+                            sink.done();
+                            return true;
+                        }
+                        if (!sink.write(chunk.data(), chunk.size())) {
+                            relay->cancel();
+                            return false;
+                        }
+                        return true;
+                    },
+                    [relay](bool /*success*/) { relay->cancel(); });
+                return;
+            }
+
+            if (wants_stream) {
+                // Ollama-dialect streaming: translate the request once,
+                // convert NDJSON chunks to SSE deltas as they arrive
+                auto request_json = arena_json::parse(req.body);
+                arena_json ollama_request = {
+                    {"model", request_json.value("model", "llama2")},
+                    {"messages", request_json["messages"]},
+                    {"stream", true}
+                };
+                auto options = translate_sampling_options(request_json);
+                if (!options.empty()) {
+                    ollama_request["options"] = std::move(options);
+                }
+
+                auto relay = std::make_shared<StreamRelay>();
+                std::string backend_url = target->url + "/api/chat";
+                std::string ollama_body = ollama_request.dump();
+                std::string model_name = request_json.value("model", "unknown");
+
+                // The transfer runs on the engine's event loop and pushes
+                // SSE events into the relay; the content provider below
+                // drains it. The generation slot (and the router's
+                // in-flight count) stays held until the transfer ends,
+                // even though this handler returns immediately.
+                auto converter = std::make_shared<NdjsonToSse>(*relay, model_name);
+                inflight_completions_.fetch_add(1);
+                slot_guard.armed = false;  // on_done releases the slot
+                std::string backend_name = target->name;
+                auto started = std::chrono::steady_clock::now();
+                TransferEngine::instance().submit_post(
+                    backend_url, std::move(ollama_body),
+                    config_.completion_timeout_seconds,
+                    [relay, converter](const char* data, size_t len) -> int {
+                        if (relay->is_cancelled()) return TransferEngine::kDataAbort;
+                        // The converter pauses mid-buffer when the
+                        // relay fills and resumes without duplicating
+                        // events - see NdjsonToSse::feed
+                        return converter->feed(data, len);
+                    },
+                    [this, relay, converter, backend_name, started](bool success, long) {
+                        converter->finish();
+                        relay->close();
+                        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - started).count();
+                        router_->on_request_finish(backend_name, elapsed_ms, success);
+                        inflight_completions_.fetch_sub(1);
+                    },
+                    [relay]() { return relay->is_cancelled(); });
+
+                res.set_chunked_content_provider(
+                    "text/event-stream",
+                    [relay](size_t /*offset*/, httplib::DataSink& sink) {
+                        std::string chunk;
+                        if (!relay->pop(chunk)) {
+                            sink.done();
+                            return true;
+                        }
+                        if (!sink.write(chunk.data(), chunk.size())) {
+                            // Client disconnected - abort the backend transfer
+                            relay->cancel();
+                            return false;
+                        }
+                        return true;
+                    },
+                    [relay](bool /*success*/) {
+                        // Make sure the transfer thread is unblocked even if
+                        // httplib tears the response down early
+                        relay->cancel();
+                    });
+                return;
+            }
+
+            // ----------------------------------------------------------------
+            // Buffered forward with failover: the router's pick goes
+            // first, then the remaining healthy services in priority
+            // order. A backend dying mid-fleet costs this request one
+            // retry, not a 502.
+            // ----------------------------------------------------------------
+            auto snapshot = discovery_->get_snapshot();
+            std::vector<ServiceInfo> candidates;
+            candidates.reserve(snapshot->size());
+            candidates.push_back(*target);
+            // Backends hosting the requested model go ahead of the rest
+            for (const auto& service : *snapshot) {
+                if (service.name != target->name &&
+                    (requested_model.empty() || service.models.count(requested_model))) {
+                    candidates.push_back(service);
+                }
+            }
+            for (const auto& service : *snapshot) {
+                if (service.name != target->name &&
+                    !(requested_model.empty() || service.models.count(requested_model))) {
+                    candidates.push_back(service);
+                }
+            }
+
+            constexpr size_t kMaxAttempts = 3;
+            auto failover_deadline = std::chrono::steady_clock::now()
+                + std::chrono::seconds(config_.failover_deadline_seconds);
+
+            // The Ollama translation is built lazily, once, and only if
+            // some candidate actually needs that dialect
+            arena_json request_json;
+            std::string ollama_body;
+            bool translated = false;
+
+            int status = 0;
+            std::string body;
+            const ServiceInfo* served_by = nullptr;
+
+            for (size_t attempt = 0;
+                 attempt < candidates.size() && attempt < kMaxAttempts;
+                 attempt++) {
+                const ServiceInfo& backend = candidates[attempt];
+
+                if (attempt > 0) {
+                    if (std::chrono::steady_clock::now() >= failover_deadline) break;
+                    log_warn("Proxy", "Failing over to " + backend.name);
+                }
+
+                std::string backend_url;
+                const std::string* forward_body;
+                if (backend.openai_native) {
+                    backend_url = backend.url + "/v1/chat/completions";
+                    forward_body = &req.body;  // Verbatim pass-through
+                } else {
+                    if (!translated) {
+                        request_json = arena_json::parse(req.body);
+                        arena_json ollama_request = {
+                            {"model", request_json.value("model", "llama2")},
+                            {"messages", request_json["messages"]},
+                            {"stream", false}
+                        };
+                        auto options = translate_sampling_options(request_json);
+                        if (!options.empty()) {
+                            ollama_request["options"] = std::move(options);
+                        }
+                        ollama_body = ollama_request.dump();
+                        translated = true;
+                    }
+                    backend_url = backend.url + "/api/chat";
+                    forward_body = &ollama_body;
+                }
+
+                if (attempt == 0) {
+                    // First attempt runs on the admission slot already
+                    // reserved; its on_request_finish below releases it
+                    slot_guard.armed = false;
+                } else {
+                    // Failover attempts bypass admission - at this
+                    // point eating one over-limit request beats a 502
+                    router_->on_request_start(backend.name);
+                }
+                auto forward_started = std::chrono::steady_clock::now();
+
+                std::tie(status, body) = http_post(backend_url, *forward_body,
+                                                   config_.completion_timeout_seconds,
+                                                   client_gone);
+
+                auto forward_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - forward_started).count();
+                router_->on_request_finish(backend.name, forward_ms,
+                                           status >= 200 && status < 500);
+
+                if (status == 0 || status >= 500) {
+                    // Connection failure or backend error: mark it
+                    // suspect and try the next candidate
+                    metrics_.record_backend_error(backend.name);
+                    discovery_->report_forward_failure(backend.name);
+                    continue;
+                }
+
+                served_by = &backend;
+                break;
+            }
+
+            if (!served_by) {
+                json error = {{"error", "All backends failed"}};
                 res.set_content(error.dump(), "application/json");
                 res.status = 502;
                 return;
             }
-            
+
+            if (served_by->openai_native) {
+                // Splice the response bytes back untouched
+                if (cache_key && status == 200) {
+                    completion_cache_.put(*cache_key, body,
+                                          config_.completion_cache_ttl_seconds);
+                }
+                res.set_content(body, "application/json");
+                res.status = status;
+                return;
+            }
+
             // Convert Ollama response back to OpenAI format
             try {
-                auto ollama_response = json::parse(body);
-                
-                json openai_response = {
+                auto ollama_response = arena_json::parse(body);
+
+                arena_json openai_response = {
                     {"id", "chatcmpl-zeroconfai"},
                     {"object", "chat.completion"},
                     {"created", std::time(nullptr)},
@@ -479,7 +3322,15 @@ void ProxyServer::run_server() {
                     }}
                 };
                 
-                res.set_content(openai_response.dump(2), "application/json");
+                std::string rendered = openai_response.dump(2);
+                // Only cache real successes - a 4xx body that happens
+                // to parse would otherwise be replayed as a 200
+                // completion for the whole TTL
+                if (cache_key && status == 200) {
+                    completion_cache_.put(*cache_key, rendered,
+                                          config_.completion_cache_ttl_seconds);
+                }
+                res.set_content(rendered, "application/json");
                 res.status = 200;
                 
             } catch (const std::exception& e) {
@@ -494,16 +3345,88 @@ void ProxyServer::run_server() {
             res.status = 500;
         }
     });
-    
+
     // ========================================================================
-    // Start the server
+    // Route: POST /v1/embeddings (micro-batched)
     // ========================================================================
-    std::cout << "[Proxy] Starting server on " << config_.host << ":" << config_.port << std::endl;
-    std::cout << "[Proxy] OpenAI-compatible API: http://" << config_.host << ":" 
-              << config_.port << "/v1" << std::endl;
-    std::cout << "[Proxy] Point Jan to this endpoint!" << std::endl;
-    
-    server.listen(config_.host, config_.port);
+    server.Post("/v1/embeddings", [this](const httplib::Request& req, httplib::Response& res) {
+        RequestTimer timer{metrics_, Metrics::kRouteEmbeddings, res};
+
+        auto parsed = json::parse(req.body, nullptr, false);
+        if (parsed.is_discarded() || !parsed.is_object() ||
+            !parsed.contains("model") || !parsed["model"].is_string() ||
+            !parsed.contains("input")) {
+            json error = {{"error", "Request must include model and input"}};
+            res.set_content(error.dump(), "application/json");
+            res.status = 400;
+            return;
+        }
+
+        // OpenAI accepts a single string or an array of strings
+        std::vector<std::string> inputs;
+        const auto& input = parsed["input"];
+        if (input.is_string()) {
+            inputs.push_back(input.get<std::string>());
+        } else if (input.is_array()) {
+            for (const auto& item : input) {
+                if (!item.is_string()) {
+                    json error = {{"error", "input array must contain strings"}};
+                    res.set_content(error.dump(), "application/json");
+                    res.status = 400;
+                    return;
+                }
+                inputs.push_back(item.get<std::string>());
+            }
+        }
+        if (inputs.empty()) {
+            json error = {{"error", "input must not be empty"}};
+            res.set_content(error.dump(), "application/json");
+            res.status = 400;
+            return;
+        }
+
+        // The batcher merges concurrent callers for the same model
+        // into one backend call and splits the vectors back out
+        auto [status, body] = embedding_batcher_->embed(
+            parsed["model"].get<std::string>(), std::move(inputs),
+            config_.embeddings_batch_window_ms,
+            config_.completion_timeout_seconds);
+
+        res.set_content(body, "application/json");
+        res.status = status;
+    });
+}
+
+void ProxyServer::run_server() {
+    // The server itself was built (and its routes registered) in
+    // start(); this thread only runs the accept loop
+    log_info("Proxy", "Starting server on " + config_.host + ":" + std::to_string(config_.port));
+    log_info("Proxy", "OpenAI-compatible API: http://" + config_.host + ":" +
+             std::to_string(config_.port) + "/v1");
+    log_info("Proxy", "Point Jan to this endpoint!");
+
+    // A stop() may already have run before this thread got scheduled
+    if (!running_.load()) return;
+    http_server_->listen(config_.host, config_.port);
+}
+
+void ProxyServer::run_unix_server() {
+    // Same-host clients skip the loopback TCP stack entirely: a Unix
+    // socket saves a syscall-and-copy pair per request and can't
+    // exhaust ephemeral ports under thousands of short /v1/models
+    // polls. Point local clients at the socket path; remote ones keep
+    // using host:port.
+    // A stale socket file from a crashed run would make bind() fail
+    ::unlink(config_.unix_socket_path.c_str());
+
+    uds_server_->set_address_family(AF_UNIX);
+
+    log_info("Proxy", "Also listening on unix socket " + config_.unix_socket_path);
+
+    if (!running_.load()) return;
+    uds_server_->listen(config_.unix_socket_path, 80);  // Port is ignored for AF_UNIX
+
+    ::unlink(config_.unix_socket_path.c_str());
 }
 
 } // namespace zeroconf
\ No newline at end of file